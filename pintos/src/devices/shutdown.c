@@ -21,6 +21,11 @@
 /* How to shut down when shutdown() is called. */
 static enum shutdown_type how = SHUTDOWN_NONE;
 
+#ifdef FILESYS
+/* Timer ticks taken to shut down the file system. */
+static int64_t filesys_done_ticks;
+#endif
+
 static void print_stats (void);
 
 /* Shuts down the machine in the way configured by
@@ -92,8 +97,9 @@ shutdown_power_off (void)
   const char *p;
 
 #ifdef FILESYS
-  flush_cache();
+  int64_t start = timer_ticks ();
   filesys_done ();
+  filesys_done_ticks = timer_elapsed (start);
 #endif
 
   print_stats ();
@@ -134,6 +140,8 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  cache_print_stats ();
+  printf ("Filesys: shutdown took %lld ticks\n", filesys_done_ticks);
 #endif
   console_print_stats ();
   kbd_print_stats ();
@@ -1,205 +1,1109 @@
 #include <string.h>
+#include <debug.h>
+#include <stdio.h>
 #include "threads/malloc.h"
 #include <stdbool.h>
+#include <stdlib.h>
 #include <list.h>
+#include <round.h>
+#include <hash.h>
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #include "filesys/cache.h"
 
+/* The replacement queues keep data and metadata blocks apart, so
+   that a data victim is found without stepping over the metadata
+   blocks protected by the reserve. */
+enum segment {
+  SEG_DATA,  // CACHE_DATA blocks
+  SEG_META,  // every other class
+  SEG_CNT
+};
+
+/* Life cycle of a cache block.  A FREE block caches nothing.  A
+   LOADING block is indexed under its new sector while the thread
+   that claimed it fills it in; threads that miss on the same sector
+   meanwhile find it and wait on its lock instead of reading the
+   sector again.  A WRITING block is being written back and stays
+   indexed under its sector until the write completes, so nobody
+   reads the stale copy on disk in the meantime. */
+enum block_state {
+  BLOCK_FREE,  // not caching any sector
+  BLOCK_LOADING,  // being filled by the thread that claimed it
+  BLOCK_VALID,  // same contents as the disk
+  BLOCK_DIRTY,  // modified since it was last written back
+  BLOCK_WRITING  // being written back
+};
+
 struct cache_entry {
   block_sector_t sector;  // sector number on disk
   char data[BLOCK_SECTOR_SIZE];  // cached data
-  bool dirty;  // block was written or not
-  struct lock cache_lock;  // lock for this cache
-  struct list_elem elem;  // list_elem used for the LRU list
+  enum block_state state;  // see enum block_state
+  enum cache_class class;  // what the sector holds
+  block_sector_t owner;  // inode sector the block belongs to
+  int64_t dirty_since;  // timer tick at which the block became dirty
+  bool prefetched;  // loaded by read-ahead and not yet accessed
+  int pin_cnt;  // number of cache_get()s not yet matched by cache_put()
+  struct lock cache_lock;  // held from cache_get() to cache_put()
+  struct list_elem elem;  // list_elem used by the LRU and 2Q queues
+  bool referenced;  // CLOCK reference bit
+  bool frequent;  // 2Q: on the Am queue rather than A1in
+  bool evicting;  // off the replacement lists while claim_entry() writes it
+  enum segment seg;  // segment whose queue the block is on
+  int64_t queued;  // queue_clock when it last joined a queue
+  struct list_elem hash_elem;  // list_elem used for the sector index
+};
+
+struct cache_entry *cache;  // CACHE_SIZE entries from the kernel pool
+size_t cache_size;  // number of entries in the cache
+struct list LRU[SEG_CNT];
+int64_t queue_clock;  // orders blocks across the queues of a segment pair
+struct list *cache_index;  // sector -> entry chains
+size_t num_buckets;  // power of two, at least CACHE_SIZE
+struct lock global_cache_lock;
+size_t counter = 0;  // keeps track of number of blocks in the cache
+size_t dirty_cnt = 0;  // number of dirty blocks in the cache
+size_t pinned_cnt = 0;  // number of outstanding pins over all blocks
+struct condition cache_unpinned;  // signaled when a block is unpinned
+
+/* Write-behind tunables, settable from the kernel command line. */
+int cache_flush_interval_ms = 1000;
+int cache_dirty_age_ms = 5000;
+int cache_dirty_ratio = 50;
+
+/* Metadata blocks are only evicted while they fill more than
+   cache_meta_pct percent of the cache, so that a large data scan
+   cannot push out the inodes and index blocks every lookup needs. */
+int cache_meta_pct = 25;
+size_t class_cnt[CACHE_CLASS_CNT];  // resident blocks of each class
+
+/* Per-class statistics. */
+size_t cache_class_access[CACHE_CLASS_CNT];
+size_t cache_class_hit[CACHE_CLASS_CNT];
+
+/* Run by the write-behind thread before each pass, so that the file
+   system can bring blocks up to date that the blocks about to be
+   written depend on. */
+void (*write_behind_hook)(void);
+
+/* Most blocks the write-behind thread writes back per wakeup. */
+#define WRITE_BEHIND_BATCH 16
+
+/* Dirty blocks of a flush_cache() in progress, sorted by sector;
+   flush_lock serializes flushes. */
+struct cache_entry **flush_order;
+struct lock flush_lock;
+
+/* Flush statistics. */
+size_t cache_flush_cnt;  // calls to flush_cache() and cache_sync()
+size_t cache_flush_blocks;  // blocks they wrote back
+size_t cache_flush_runs;  // runs of consecutive sectors among those
+int64_t cache_flush_ticks;  // timer ticks they took
+
+/* Read-ahead statistics. */
+size_t cache_readahead;  // blocks loaded by the read-ahead thread
+size_t cache_readahead_hit;  // of those, blocks later accessed
+
+/* Sectors waiting for the read-ahead thread.  Requests that arrive
+   while the queue is full are dropped. */
+#define READ_AHEAD_QUEUE 64
+block_sector_t read_ahead_queue[READ_AHEAD_QUEUE];
+size_t read_ahead_head = 0;  // next request to serve
+size_t read_ahead_cnt = 0;  // number of queued requests
+struct lock read_ahead_lock;
+struct condition read_ahead_cond;  // signaled when a request is queued
+
+/* A replacement policy.  Every hook runs with global_cache_lock
+   held, and EVICT is only called once every block is in use.  EVICT
+   passes over pinned blocks, considers metadata blocks only if META
+   is true, and returns NULL if there is no victim.  A victim that
+   claim_entry() gives back after writing it is handed to REINSERT,
+   which queues it again as if it had not been evicted. */
+struct cache_policy {
+  const char *name;
+  void (*init)(void);  // forget every block
+  void (*insert)(struct cache_entry *);  // block now caches a new sector
+  void (*touch)(struct cache_entry *);  // block was accessed again
+  struct cache_entry *(*evict)(bool meta);  // choose a victim, forget it
+  void (*reinsert)(struct cache_entry *);  // take back an evicted block
 };
 
-struct cache_entry cache[64];
-struct list LRU;
-struct lock global_cache_lock; 
-int counter = 0;  // keeps track of number of blocks in the cache
+static void lru_init(void);
+static void lru_insert(struct cache_entry *block);
+static void lru_touch(struct cache_entry *block);
+static struct cache_entry *lru_evict(bool meta);
+static void lru_reinsert(struct cache_entry *block);
+static void clock_init(void);
+static void clock_insert(struct cache_entry *block);
+static void clock_touch(struct cache_entry *block);
+static struct cache_entry *clock_evict(bool meta);
+static void clock_reinsert(struct cache_entry *block);
+static void twoq_init(void);
+static void twoq_insert(struct cache_entry *block);
+static void twoq_touch(struct cache_entry *block);
+static struct cache_entry *twoq_evict(bool meta);
+static void twoq_reinsert(struct cache_entry *block);
+
+static const struct cache_policy policies[] = {
+  {"lru", lru_init, lru_insert, lru_touch, lru_evict, lru_reinsert},
+  {"clock", clock_init, clock_insert, clock_touch, clock_evict,
+   clock_reinsert},
+  {"2q", twoq_init, twoq_insert, twoq_touch, twoq_evict, twoq_reinsert},
+};
+static const struct cache_policy *policy = &policies[0];
 
+static struct list *index_bucket(block_sector_t sector);
+static struct cache_entry *index_lookup(block_sector_t sector);
+static struct cache_entry *claim_entry(block_sector_t target_sector,
+                                       enum cache_class class, bool wait);
+static enum segment segment_of(const struct cache_entry *block);
+static bool meta_over_reserve(void);
+static void set_class(struct cache_entry *block, enum cache_class class);
+static void mark_dirty(struct cache_entry *block);
+static void write_back(block_sector_t owner);
+static void pin(struct cache_entry *block);
+static void unpin(struct cache_entry *block);
+static void write_behind(void *aux);
+static size_t write_behind_pass(void);
+static void read_ahead(void *aux);
+static void note_access(struct cache_entry *block);
+
+
+/* Allocates zeroed kernel pages for ENTRY_CNT objects of SIZE
+   bytes each, panicking if they do not fit. */
+static void *alloc_pages(size_t entry_cnt, size_t size) {
+  size_t page_cnt = DIV_ROUND_UP(entry_cnt * size, PGSIZE);
+  void *pages = palloc_get_multiple(PAL_ZERO, page_cnt);
+  if (pages == NULL) {
+    PANIC("buffer cache: %zu pages for %zu entries do not fit in the "
+          "kernel pool (try a smaller -cache)", page_cnt, entry_cnt);
+  }
+  return pages;
+}
+
+void initialize_cache(size_t entry_cnt) {
+  ASSERT(entry_cnt > 0);
+  cache_size = entry_cnt;
+  cache = alloc_pages(cache_size, sizeof *cache);
+
+  // size the index so each chain holds about one entry
+  num_buckets = 1;
+  while (num_buckets < cache_size) {
+    num_buckets *= 2;
+  }
+  cache_index = alloc_pages(num_buckets, sizeof *cache_index);
+  flush_order = alloc_pages(cache_size, sizeof *flush_order);
+  lock_init(&flush_lock);
 
-void initialize_cache() {
   // initialize cache locks
-  for (int i = 0; i < 64; i++) {
+  for (size_t i = 0; i < cache_size; i++) {
     lock_init(&(cache[i].cache_lock));
   }
 
-  // initialize LRU list and global lock
-  list_init(&LRU);
+  // initialize replacement state, sector index and global lock
+  policy->init();
+  for (size_t i = 0; i < num_buckets; i++) {
+    list_init(&cache_index[i]);
+  }
   lock_init(&global_cache_lock);
+  cond_init(&cache_unpinned);
 
   // for calculating hit and miss rate
   cache_access = 0;
   cache_hit = 0;
-}
+  cache_readahead = 0;
+  cache_readahead_hit = 0;
 
-void read_from_cache(block_sector_t target_sector, void *buff) {
-  lock_acquire(&global_cache_lock);
-  cache_access++;
-  struct cache_entry *block;
-
-  int i = 0;
-  while (i < counter) {
-    block = &cache[i];
-    lock_acquire(&block->cache_lock);
-    if (block->sector == target_sector) {
-      update_LRU2(block);
-      lock_release(&global_cache_lock);
+  lock_init(&read_ahead_lock);
+  cond_init(&read_ahead_cond);
 
-      memcpy(buff, block->data, BLOCK_SECTOR_SIZE);
-      lock_release(&block->cache_lock);
+  thread_create("write-behind", PRI_DEFAULT, write_behind, NULL);
+  thread_create("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+}
 
-      cache_hit++;
+/* Returns the index chain that SECTOR hashes to. */
+static struct list *index_bucket(block_sector_t sector) {
+  return &cache_index[hash_int(sector) & (num_buckets - 1)];
+}
 
-      return;
+/* Returns the entry caching SECTOR, or NULL if it is not cached.
+   Must be called with global_cache_lock held; takes no entry
+   locks. */
+static struct cache_entry *index_lookup(block_sector_t sector) {
+  struct list *bucket = index_bucket(sector);
+  struct list_elem *e;
+  for (e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+    struct cache_entry *block = list_entry(e, struct cache_entry, hash_elem);
+    if (block->sector == sector) {
+      return block;
     }
-    i++;
-    lock_release(&block->cache_lock);
   }
+  return NULL;
+}
+
+/* Picks an empty block or evicts the one the replacement policy
+   chooses, re-indexes it under TARGET_SECTOR, which must not be
+   cached, and returns it pinned, locked and LOADING.
+   A dirty victim is first written back with global_cache_lock
+   released.  If somebody asks for the victim's sector meanwhile, or
+   caches TARGET_SECTOR, the victim is given back and NULL is
+   returned, as it is when every block is pinned: the caller should
+   look TARGET_SECTOR up again.  In the latter case the call first
+   waits for a block to be unpinned if WAIT is true.  The reserve of
+   metadata blocks is given up before waiting.  The block is tagged
+   with CLASS.
+   Must be called with global_cache_lock held. */
+static struct cache_entry *claim_entry(block_sector_t target_sector,
+                                       enum cache_class class, bool wait) {
+  struct cache_entry *block;
 
-  if (counter < 64) {
+  if (counter < cache_size) {
     // find an empty block
     block = &cache[counter];
     counter++;
+  } else {
+    // evict and replace; metadata only competes beyond its reserve
+    bool meta = meta_over_reserve();
+    block = policy->evict(meta);
+    if (block == NULL && !meta) {
+      // only metadata is left: dip into its reserve
+      block = policy->evict(true);
+    }
+    if (block == NULL) {
+      // every block is pinned: wait for one to be put back
+      if (wait) {
+        cond_wait(&cache_unpinned, &global_cache_lock);
+      }
+      return NULL;
+    }
+  }
 
-    update_LRU1(block);
+  // an unpinned block is never locked, so this cannot fail
+  pin(block);
+  bool locked = lock_try_acquire(&block->cache_lock);
+  ASSERT(locked);
+
+  if (block->state == BLOCK_DIRTY) {
+    // write back without the global lock; the victim stays indexed,
+    // so threads wanting its sector wait for the write, but it is on
+    // no replacement list, so they must not touch it
+    block->state = BLOCK_WRITING;
+    block->evicting = true;
+    dirty_cnt--;
     lock_release(&global_cache_lock);
+    block_write(fs_device, block->sector, block->data);
+    lock_acquire(&global_cache_lock);
+    block->state = BLOCK_VALID;
+    block->evicting = false;
 
-    lock_acquire(&block->cache_lock);
-    block->sector = target_sector;
-    block_read(fs_device, target_sector, buff);
-    memcpy(block->data, buff, BLOCK_SECTOR_SIZE);
-    block->dirty = false;
-    lock_release(&block->cache_lock);
+    if (block->pin_cnt > 1 || index_lookup(target_sector) != NULL) {
+      // still wanted, or no longer needed: keep it cached
+      policy->reinsert(block);
+      lock_release(&block->cache_lock);
+      unpin(block);
+      return NULL;
+    }
+  }
 
-  } else {
-    // evict and replace
-    struct list_elem *block_elem = list_front(&LRU);
-    block = list_entry(block_elem, struct cache_entry, elem);
+  if (block->state != BLOCK_FREE) {
+    list_remove(&block->hash_elem);
+    class_cnt[block->class]--;
+  }
+  block->class = class;
+  class_cnt[class]++;
+  block->owner = CACHE_NO_OWNER;
+  block->sector = target_sector;
+  block->state = BLOCK_LOADING;
+  block->prefetched = false;
+  list_push_back(index_bucket(target_sector), &block->hash_elem);
+  policy->insert(block);
+  return block;
+}
 
-    update_LRU2(block);
-    lock_release(&global_cache_lock);
+/* Returns the cache block for TARGET_SECTOR, which holds CLASS,
+   pinned and locked, so that its data can be used in place through
+   cache_data() until the matching cache_put().  A pinned block is
+   never evicted.  Unless OWNER is CACHE_NO_OWNER, the block is
+   recorded as belonging to the inode in sector OWNER, for
+   cache_sync().  With CACHE_READ the block holds the sector's
+   contents; with CACHE_ZERO it is zero-filled instead and the device
+   is not read, for callers that are about to overwrite the whole
+   sector.
+   A thread must not get a sector it already holds. */
+struct cache_entry *cache_get(block_sector_t target_sector,
+                              enum cache_class class, block_sector_t owner,
+                              enum cache_mode mode) {
+  struct cache_entry *block;
 
-    lock_acquire(&block->cache_lock);
-    if (block->dirty) {
-      // write back to disk
-      block_write(fs_device, block->sector, block->data);
+  lock_acquire(&global_cache_lock);
+  cache_access++;
+  cache_class_access[class]++;
+  for (;;) {
+    block = index_lookup(target_sector);
+    if (block != NULL) {
+      pin(block);
+      set_class(block, class);
+      if (!block->evicting) {
+        policy->touch(block);
+      }
+      note_access(block);
+      cache_hit++;
+      cache_class_hit[class]++;
+      lock_release(&global_cache_lock);
+
+      // never wait for a block lock while holding the global lock;
+      // this also waits out a load or write-back in progress
+      lock_acquire(&block->cache_lock);
+      ASSERT(block->sector == target_sector);
+      if (owner != CACHE_NO_OWNER) {
+        block->owner = owner;
+      }
+      if (mode == CACHE_ZERO) {
+        memset(block->data, 0, BLOCK_SECTOR_SIZE);
+      }
+      return block;
+    }
+
+    block = claim_entry(target_sector, class, true);
+    if (block != NULL) {
+      break;
     }
-    block->sector = target_sector;
-    block_read(fs_device, target_sector, buff);
-    memcpy(block->data, buff, BLOCK_SECTOR_SIZE);
-    block->dirty = false;
-    lock_release(&block->cache_lock);
-  } 
+  }
+  lock_release(&global_cache_lock);
+
+  if (owner != CACHE_NO_OWNER) {
+    block->owner = owner;
+  }
+  if (mode == CACHE_ZERO) {
+    memset(block->data, 0, BLOCK_SECTOR_SIZE);
+  } else {
+    block_read(fs_device, target_sector, block->data);
+  }
+  return block;
+}
+
+/* Returns the cached data of BLOCK, which must be pinned by the
+   calling thread. */
+void *cache_data(struct cache_entry *block) {
+  ASSERT(lock_held_by_current_thread(&block->cache_lock));
+  return block->data;
+}
+
+/* Releases BLOCK, obtained from cache_get().  DIRTY says whether
+   the caller modified its data. */
+void cache_put(struct cache_entry *block, bool dirty) {
+  ASSERT(lock_held_by_current_thread(&block->cache_lock));
+  lock_acquire(&global_cache_lock);
+  if (dirty) {
+    mark_dirty(block);
+  } else if (block->state == BLOCK_LOADING || block->state == BLOCK_WRITING) {
+    block->state = BLOCK_VALID;
+  }
+  lock_release(&block->cache_lock);
+  unpin(block);
+  lock_release(&global_cache_lock);
+}
+
+/* Copies LEN bytes starting at byte OFS of TARGET_SECTOR, which
+   holds CLASS, into BUFF, straight out of the cached copy. */
+void cache_read_at(block_sector_t target_sector, enum cache_class class,
+                   size_t ofs, size_t len, void *buff) {
+  ASSERT(ofs + len <= BLOCK_SECTOR_SIZE);
+  struct cache_entry *block = cache_get(target_sector, class, CACHE_NO_OWNER,
+                                        CACHE_READ);
+  memcpy(buff, block->data + ofs, len);
+  cache_put(block, false);
+}
+
+/* Copies LEN bytes from BUFF to byte OFS of TARGET_SECTOR, which
+   holds CLASS and belongs to OWNER, patching the cached copy in
+   place.  The sector is only read from the device if the write
+   leaves part of it unchanged. */
+void cache_write_at(block_sector_t target_sector, enum cache_class class,
+                    block_sector_t owner, size_t ofs, size_t len,
+                    const void *buff) {
+  ASSERT(ofs + len <= BLOCK_SECTOR_SIZE);
+  enum cache_mode mode = len == BLOCK_SECTOR_SIZE ? CACHE_ZERO : CACHE_READ;
+  struct cache_entry *block = cache_get(target_sector, class, owner, mode);
+  memcpy(block->data + ofs, buff, len);
+  cache_put(block, true);
+}
+
+void read_from_cache(block_sector_t target_sector, void *buff) {
+  cache_read_at(target_sector, CACHE_DATA, 0, BLOCK_SECTOR_SIZE, buff);
 }
 
 void write_to_cache(block_sector_t target_sector, void *buff) {
+  cache_write_at(target_sector, CACHE_DATA, CACHE_NO_OWNER, 0,
+                 BLOCK_SECTOR_SIZE, buff);
+}
+
+/* Returns the replacement segment for BLOCK's class. */
+static enum segment segment_of(const struct cache_entry *block) {
+  return block->class == CACHE_DATA ? SEG_DATA : SEG_META;
+}
+
+/* Returns true if metadata fills more than its reserve, so that
+   metadata blocks compete with data blocks for eviction.
+   Must be called with global_cache_lock held. */
+static bool meta_over_reserve(void) {
+  size_t meta_cnt = (class_cnt[CACHE_INODE] + class_cnt[CACHE_INDIRECT]
+                     + class_cnt[CACHE_DIRECTORY]);
+  return meta_cnt > cache_size * cache_meta_pct / 100;
+}
+
+/* Retags BLOCK, a resident block, as holding CLASS.  A sector
+   changes class when it is freed and reallocated.
+   Must be called with global_cache_lock held. */
+static void set_class(struct cache_entry *block, enum cache_class class) {
+  class_cnt[block->class]--;
+  block->class = class;
+  class_cnt[class]++;
+}
+
+/* Keeps BLOCK from being evicted.
+   Must be called with global_cache_lock held. */
+static void pin(struct cache_entry *block) {
+  block->pin_cnt++;
+  pinned_cnt++;
+}
+
+/* Undoes one pin() of BLOCK, waking up threads waiting for an
+   evictable block.  Must be called with global_cache_lock held. */
+static void unpin(struct cache_entry *block) {
+  ASSERT(block->pin_cnt > 0);
+  block->pin_cnt--;
+  pinned_cnt--;
+  if (block->pin_cnt == 0) {
+    cond_broadcast(&cache_unpinned, &global_cache_lock);
+  }
+}
+
+/* Credits read-ahead the first time a prefetched BLOCK is used.
+   Must be called with global_cache_lock held. */
+static void note_access(struct cache_entry *block) {
+  if (block->prefetched) {
+    block->prefetched = false;
+    cache_readahead_hit++;
+  }
+}
+
+/* Marks BLOCK dirty, remembering when it first became so.
+   Must be called with global_cache_lock and BLOCK's cache_lock
+   held. */
+static void mark_dirty(struct cache_entry *block) {
+  if (block->state != BLOCK_DIRTY) {
+    block->state = BLOCK_DIRTY;
+    block->dirty_since = timer_ticks();
+    dirty_cnt++;
+  }
+}
+
+/* Orders pointers to cache blocks by sector number, for qsort(). */
+static int compare_sectors(const void *a_, const void *b_) {
+  const struct cache_entry *a = *(struct cache_entry *const *) a_;
+  const struct cache_entry *b = *(struct cache_entry *const *) b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes every dirty block back to disk. */
+void flush_cache() {
+  write_back(CACHE_NO_OWNER);
+}
+
+/* Writes the dirty blocks of the inode in sector OWNER back to disk:
+   its data, its indirect blocks and the inode itself.  Other dirty
+   blocks stay in the cache. */
+void cache_sync(block_sector_t owner) {
+  ASSERT(owner != CACHE_NO_OWNER);
+  write_back(owner);
+}
+
+/* Writes the dirty blocks that belong to OWNER, or all of them if
+   OWNER is CACHE_NO_OWNER, back in ascending sector order, so the
+   disk makes a single sweep instead of seeking back and forth.  The
+   block layer transfers one sector per request, so a run of
+   adjacent sectors goes out as back-to-back writes; the runs are
+   counted for cache_print_stats(). */
+static void write_back(block_sector_t owner) {
+  lock_acquire(&flush_lock);
+  int64_t start = timer_ticks();
+
+  // pin the dirty blocks so that their sectors stay put while sorted
   lock_acquire(&global_cache_lock);
-  cache_access++;
-  struct cache_entry *block;
+  size_t cnt = 0;
+  for (size_t i = 0; i < counter; i++) {
+    struct cache_entry *block = &cache[i];
+    if (block->state == BLOCK_DIRTY
+        && (owner == CACHE_NO_OWNER || block->owner == owner)) {
+      pin(block);
+      flush_order[cnt++] = block;
+    }
+  }
+  lock_release(&global_cache_lock);
+  qsort(flush_order, cnt, sizeof *flush_order, compare_sectors);
 
-  int i = 0;
-  while (i < counter) {
-    block = &cache[i];
+  size_t written = 0;
+  size_t runs = 0;
+  block_sector_t last = 0;
+  for (size_t i = 0; i < cnt; i++) {
+    struct cache_entry *block = flush_order[i];
     lock_acquire(&block->cache_lock);
-    if (block->sector == target_sector) {
-      update_LRU2(block);
-      lock_release(&global_cache_lock);
 
-      memcpy(block->data, buff, BLOCK_SECTOR_SIZE);
-      block->dirty = true;
-      lock_release(&block->cache_lock);
+    lock_acquire(&global_cache_lock);
+    bool dirty = block->state == BLOCK_DIRTY;
+    if (dirty) {
+      block->state = BLOCK_WRITING;
+      dirty_cnt--;
+    }
+    lock_release(&global_cache_lock);
 
-      cache_hit++;
-      
-      return;
+    if (dirty) {
+      block_write(fs_device, block->sector, block->data);
+      if (written == 0 || block->sector != last + 1) {
+        runs++;
+      }
+      last = block->sector;
+      written++;
     }
-    i++;
-    lock_release(&block->cache_lock);
+    cache_put(block, false);
   }
 
-  if (counter < 64) {
-    // find an empty block
-    block = &cache[counter];
-    counter++;
+  cache_flush_cnt++;
+  cache_flush_blocks += written;
+  cache_flush_runs += runs;
+  cache_flush_ticks += timer_elapsed(start);
+  lock_release(&flush_lock);
+}
 
-    update_LRU1(block);
-    lock_release(&global_cache_lock);
+/* Makes the replacement policy called NAME the one used from the
+   next initialize_cache() on.  Returns false if there is no such
+   policy. */
+bool cache_select_policy(const char *name) {
+  for (size_t i = 0; i < sizeof policies / sizeof *policies; i++) {
+    if (!strcmp(name, policies[i].name)) {
+      policy = &policies[i];
+      return true;
+    }
+  }
+  return false;
+}
 
-    lock_acquire(&block->cache_lock);
-    block->sector = target_sector;
-    memcpy(block->data, buff, BLOCK_SECTOR_SIZE);
-    block->dirty = true;
-    lock_release(&block->cache_lock);
+/* Replacement queues come in pairs, one per segment.  Appends BLOCK
+   to the queue of its segment in QUEUES, stamping it so that the
+   heads of the two queues can be compared. */
+static void queue_push(struct list queues[SEG_CNT],
+                       struct cache_entry *block) {
+  block->seg = segment_of(block);
+  block->queued = queue_clock++;
+  list_push_back(&queues[block->seg], &block->elem);
+}
 
-  } else {
-    // evict and replace
-    struct list_elem *block_elem = list_front(&LRU);
-    block = list_entry(block_elem, struct cache_entry, elem);
+/* Returns the first unpinned block on QUEUE, or NULL. */
+static struct cache_entry *first_unpinned(struct list *queue) {
+  struct list_elem *e;
+  for (e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+    struct cache_entry *block = list_entry(e, struct cache_entry, elem);
+    if (block->pin_cnt == 0) {
+      return block;
+    }
+  }
+  return NULL;
+}
 
-    update_LRU2(block);
-    lock_release(&global_cache_lock);
+/* Returns the first unpinned block on the data queue of QUEUES or,
+   if META, the one of the pair queued earliest, without removing
+   it.  Returns NULL if there is none. */
+static struct cache_entry *queue_head(struct list queues[SEG_CNT],
+                                      bool meta) {
+  struct cache_entry *block = first_unpinned(&queues[SEG_DATA]);
+  if (meta) {
+    struct cache_entry *other = first_unpinned(&queues[SEG_META]);
+    if (other != NULL && (block == NULL || other->queued < block->queued)) {
+      block = other;
+    }
+  }
+  return block;
+}
 
-    lock_acquire(&block->cache_lock);
-    if (block->dirty) {
-      // write back to disk
-      block_write(fs_device, block->sector, block->data);
+/* LRU: a strict recency list, least recently used at the front. */
+
+static void lru_init(void) {
+  list_init(&LRU[SEG_DATA]);
+  list_init(&LRU[SEG_META]);
+}
+
+static void lru_insert(struct cache_entry *block) {
+  queue_push(LRU, block);
+}
+
+static void lru_touch(struct cache_entry *block) {
+  list_remove(&block->elem);
+  queue_push(LRU, block);
+}
+
+static struct cache_entry *lru_evict(bool meta) {
+  struct cache_entry *block = queue_head(LRU, meta);
+  if (block != NULL) {
+    list_remove(&block->elem);
+  }
+  return block;
+}
+
+static void lru_reinsert(struct cache_entry *block) {
+  // it was asked for while being written: it is the most recent
+  queue_push(LRU, block);
+}
+
+/* CLOCK: a hit only sets the block's reference bit.  The hand
+   sweeps the blocks, clearing set bits, and evicts the first block
+   whose bit is already clear.  The blocks of each segment form a
+   ring, kept as a queue whose head is under the hand: a block the
+   hand passes over moves to the tail. */
+
+struct list clock_ring[SEG_CNT];
+
+static void clock_init(void) {
+  list_init(&clock_ring[SEG_DATA]);
+  list_init(&clock_ring[SEG_META]);
+}
+
+static void clock_insert(struct cache_entry *block) {
+  block->referenced = true;
+  queue_push(clock_ring, block);
+}
+
+static void clock_touch(struct cache_entry *block) {
+  block->referenced = true;
+  if (block->seg != segment_of(block)) {
+    list_remove(&block->elem);
+    queue_push(clock_ring, block);
+  }
+}
+
+static struct cache_entry *clock_evict(bool meta) {
+  // two sweeps clear every reference bit, so a third finds nothing new
+  for (size_t i = 0; i < 2 * cache_size; i++) {
+    struct cache_entry *block = queue_head(clock_ring, meta);
+    if (block == NULL) {
+      break;
     }
-    block->sector = target_sector;
-    memcpy(block->data, buff, BLOCK_SECTOR_SIZE);
-    block->dirty = true;
-    lock_release(&block->cache_lock);
+    list_remove(&block->elem);
+    if (!block->referenced) {
+      return block;
+    }
+    block->referenced = false;
+    queue_push(clock_ring, block);
   }
+  return NULL;
 }
 
-void flush_cache() {
-  lock_acquire(&global_cache_lock);
-  struct cache_entry *block;
-  for (int i = 0; i < counter; i++) {
-    block = &cache[i];
-    if (block->dirty == true) {
-      lock_acquire(&block->cache_lock);
-      block->dirty = false;
-      block_write(fs_device, block->sector, block->data);
-      lock_release(&block->cache_lock);
+static void clock_reinsert(struct cache_entry *block) {
+  block->referenced = true;
+  queue_push(clock_ring, block);
+}
+
+/* 2Q (Johnson and Shasha): a new sector enters the A1in FIFO and
+   is only promoted to the Am LRU queue if it is requested again
+   after it has been evicted from A1in, which the A1out ghost queue
+   of recently evicted sector numbers detects.  A sequential scan
+   therefore only cycles through A1in and leaves Am alone. */
+
+struct twoq_ghost {
+  block_sector_t sector;
+  bool valid;
+  struct list_elem hash_elem;  // list_elem used for twoq_ghost_index
+};
+
+struct list twoq_a1in[SEG_CNT];  // FIFO of blocks referenced once
+size_t twoq_a1in_cnt[SEG_CNT];
+struct list twoq_am[SEG_CNT];  // LRU of blocks referenced again
+struct twoq_ghost *twoq_ghosts;  // A1out, a ring of twoq_ghost_cnt sectors
+size_t twoq_ghost_cnt;
+size_t twoq_ghost_next;  // oldest ghost, replaced next
+struct list *twoq_ghost_index;  // sector -> ghost chains, num_buckets long
+
+static struct list *twoq_ghost_bucket(block_sector_t sector) {
+  return &twoq_ghost_index[hash_int(sector) & (num_buckets - 1)];
+}
+
+static void twoq_init(void) {
+  if (twoq_ghosts == NULL) {
+    twoq_ghost_cnt = cache_size / 2 > 0 ? cache_size / 2 : 1;
+    twoq_ghosts = alloc_pages(twoq_ghost_cnt, sizeof *twoq_ghosts);
+    twoq_ghost_index = alloc_pages(num_buckets, sizeof *twoq_ghost_index);
+  }
+  for (int seg = 0; seg < SEG_CNT; seg++) {
+    list_init(&twoq_a1in[seg]);
+    list_init(&twoq_am[seg]);
+    twoq_a1in_cnt[seg] = 0;
+  }
+  twoq_ghost_next = 0;
+  for (size_t i = 0; i < twoq_ghost_cnt; i++) {
+    twoq_ghosts[i].valid = false;
+  }
+  for (size_t i = 0; i < num_buckets; i++) {
+    list_init(&twoq_ghost_index[i]);
+  }
+}
+
+/* Drops the A1out ghost of SECTOR, if any.  Returns true if there
+   was one. */
+static bool twoq_forget_ghost(block_sector_t sector) {
+  struct list *bucket = twoq_ghost_bucket(sector);
+  struct list_elem *e;
+  for (e = list_begin(bucket); e != list_end(bucket); e = list_next(e)) {
+    struct twoq_ghost *ghost = list_entry(e, struct twoq_ghost, hash_elem);
+    if (ghost->sector == sector) {
+      list_remove(&ghost->hash_elem);
+      ghost->valid = false;
+      return true;
     }
   }
-  lock_release(&global_cache_lock);
+  return false;
 }
 
-void update_LRU1(struct cache_entry *block) {
-  list_push_back(&LRU, &block->elem);
+/* Appends BLOCK to A1in. */
+static void twoq_push_a1in(struct cache_entry *block) {
+  queue_push(twoq_a1in, block);
+  twoq_a1in_cnt[block->seg]++;
 }
 
-void update_LRU2(struct cache_entry *block) {
+static void twoq_insert(struct cache_entry *block) {
+  if (twoq_forget_ghost(block->sector)) {
+    // evicted from A1in not long ago: it is worth keeping
+    block->frequent = true;
+    queue_push(twoq_am, block);
+    return;
+  }
+  block->frequent = false;
+  twoq_push_a1in(block);
+}
+
+static void twoq_touch(struct cache_entry *block) {
+  if (block->frequent) {
+    list_remove(&block->elem);
+    queue_push(twoq_am, block);
+  } else if (block->seg != segment_of(block)) {
+    list_remove(&block->elem);
+    twoq_a1in_cnt[block->seg]--;
+    twoq_push_a1in(block);
+  }
+}
+
+static struct cache_entry *twoq_evict(bool meta) {
+  size_t a1in_max = cache_size / 4 > 0 ? cache_size / 4 : 1;
+  size_t a1in_cnt = twoq_a1in_cnt[SEG_DATA];
+  bool am_empty = list_empty(&twoq_am[SEG_DATA]);
+  if (meta) {
+    a1in_cnt += twoq_a1in_cnt[SEG_META];
+    am_empty = am_empty && list_empty(&twoq_am[SEG_META]);
+  }
+
+  struct cache_entry *block = NULL;
+  if (a1in_cnt > a1in_max || am_empty) {
+    block = queue_head(twoq_a1in, meta);
+  }
+  if (block == NULL) {
+    // A1in is short or has no victim; fall back to it only if Am has none
+    block = queue_head(twoq_am, meta);
+    if (block == NULL) {
+      block = queue_head(twoq_a1in, meta);
+    }
+  }
+  if (block == NULL) {
+    return NULL;
+  }
   list_remove(&block->elem);
-  list_push_back(&LRU, &block->elem);
+
+  if (!block->frequent) {
+    twoq_a1in_cnt[block->seg]--;
+
+    // remember the sector in A1out, forgetting the oldest ghost
+    struct twoq_ghost *ghost = &twoq_ghosts[twoq_ghost_next];
+    twoq_ghost_next = (twoq_ghost_next + 1) % twoq_ghost_cnt;
+    if (ghost->valid) {
+      list_remove(&ghost->hash_elem);
+    }
+    ghost->sector = block->sector;
+    ghost->valid = true;
+    list_push_back(twoq_ghost_bucket(block->sector), &ghost->hash_elem);
+  }
+  return block;
 }
 
+static void twoq_reinsert(struct cache_entry *block) {
+  // back to the queue it left; the ghost twoq_evict() just recorded
+  // is for a sector that never left the cache
+  if (block->frequent) {
+    queue_push(twoq_am, block);
+  } else {
+    twoq_forget_ghost(block->sector);
+    twoq_push_a1in(block);
+  }
+}
 
-bool reset_cache() {
 
+bool reset_cache() {
   // flush cache to disk so old data is not lost
   flush_cache();
 
   lock_acquire(&global_cache_lock);
 
-  int i = 0;
+  // wait until nobody holds a block: an unpinned block is unlocked
+  // and cannot be pinned again while we hold the global lock
+  while (pinned_cnt > 0) {
+    cond_wait(&cache_unpinned, &global_cache_lock);
+  }
+
+  // write back whatever was dirtied since the flush
+  size_t i = 0;
   while (i < counter) {
     struct cache_entry *block = &cache[i];
+    if (block->state == BLOCK_DIRTY) {
+      block_write(fs_device, block->sector, block->data);
+    }
+    block->state = BLOCK_FREE;
     block->sector = 0;
     i++;
   }
 
   counter = 0;
-  list_init(&LRU);
+  dirty_cnt = 0;
+  for (i = 0; i < CACHE_CLASS_CNT; i++) {
+    class_cnt[i] = 0;
+    cache_class_access[i] = 0;
+    cache_class_hit[i] = 0;
+  }
+  policy->init();
+  for (i = 0; i < num_buckets; i++) {
+    list_init(&cache_index[i]);
+  }
 
   cache_hit = 0;
   cache_access = 0;
+  cache_readahead = 0;
+  cache_readahead_hit = 0;
 
   lock_release(&global_cache_lock);
 
   return true;
 }
+
+/* Body of the write-behind thread: wakes up every
+   cache_flush_interval_ms and writes back a batch of dirty blocks,
+   so dirty data reaches the disk without waiting for eviction and
+   evictions mostly find clean victims. */
+static void write_behind(void *aux UNUSED) {
+  for (;;) {
+    timer_sleep((int64_t) cache_flush_interval_ms * TIMER_FREQ / 1000);
+    if (write_behind_hook != NULL) {
+      write_behind_hook();
+    }
+    write_behind_pass();
+  }
+}
+
+/* Writes back up to WRITE_BEHIND_BATCH dirty blocks, longest dirty
+   first.  A block qualifies once it has been dirty for
+   cache_dirty_age_ms, or at any age while more than
+   cache_dirty_ratio percent of the cache is dirty.  Blocks somebody
+   else holds are left for the next pass.  Returns the number of
+   blocks written. */
+static size_t write_behind_pass(void) {
+  struct cache_entry *batch[WRITE_BEHIND_BATCH];
+  size_t batch_cnt = 0;
+  size_t written = 0;
+  int64_t max_age = (int64_t) cache_dirty_age_ms * TIMER_FREQ / 1000;
+
+  // keep the longest dirty blocks, oldest first, in BATCH
+  lock_acquire(&global_cache_lock);
+  size_t excess = 0;
+  if (dirty_cnt * 100 > cache_size * cache_dirty_ratio) {
+    excess = dirty_cnt - cache_size * cache_dirty_ratio / 100;
+  }
+  for (size_t i = 0; i < counter; i++) {
+    struct cache_entry *block = &cache[i];
+    if (block->state != BLOCK_DIRTY) {
+      continue;
+    }
+    size_t pos = batch_cnt;
+    while (pos > 0 && batch[pos - 1]->dirty_since > block->dirty_since) {
+      pos--;
+    }
+    if (pos == WRITE_BEHIND_BATCH) {
+      continue;
+    }
+    if (batch_cnt < WRITE_BEHIND_BATCH) {
+      batch_cnt++;
+    }
+    memmove(&batch[pos + 1], &batch[pos],
+            (batch_cnt - 1 - pos) * sizeof *batch);
+    batch[pos] = block;
+  }
+
+  // past the excess, only blocks that are old enough qualify
+  size_t qualified = 0;
+  while (qualified < batch_cnt
+         && (qualified < excess
+             || timer_elapsed(batch[qualified]->dirty_since) >= max_age)) {
+    qualified++;
+  }
+  batch_cnt = qualified;
+  lock_release(&global_cache_lock);
+
+  // write each candidate back without holding the global lock
+  for (size_t i = 0; i < batch_cnt; i++) {
+    struct cache_entry *block = batch[i];
+    lock_acquire(&global_cache_lock);
+    if (block->state != BLOCK_DIRTY || block->pin_cnt > 0) {
+      lock_release(&global_cache_lock);
+      continue;
+    }
+    pin(block);
+    bool locked = lock_try_acquire(&block->cache_lock);
+    ASSERT(locked);
+    block->state = BLOCK_WRITING;
+    dirty_cnt--;
+    block_sector_t sector = block->sector;
+    lock_release(&global_cache_lock);
+
+    block_write(fs_device, sector, block->data);
+    cache_put(block, false);
+    written++;
+  }
+  return written;
+}
+
+/* Makes the write-behind thread call HOOK before each pass. */
+void cache_set_write_behind_hook(void (*hook)(void)) {
+  write_behind_hook = hook;
+}
+
+/* Asks the read-ahead thread to bring SECTOR into the cache.
+   Returns immediately; the request is dropped if the queue is
+   full. */
+void cache_read_ahead(block_sector_t sector) {
+  lock_acquire(&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE) {
+    read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE] = sector;
+    read_ahead_cnt++;
+    cond_signal(&read_ahead_cond, &read_ahead_lock);
+  }
+  lock_release(&read_ahead_lock);
+}
+
+/* Body of the read-ahead thread: loads queued sectors that are not
+   already cached, so that a sequential reader finds them resident
+   instead of blocking on the disk. */
+static void read_ahead(void *aux UNUSED) {
+  for (;;) {
+    lock_acquire(&read_ahead_lock);
+    while (read_ahead_cnt == 0) {
+      cond_wait(&read_ahead_cond, &read_ahead_lock);
+    }
+    block_sector_t sector = read_ahead_queue[read_ahead_head];
+    read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE;
+    read_ahead_cnt--;
+    lock_release(&read_ahead_lock);
+
+    lock_acquire(&global_cache_lock);
+    struct cache_entry *block = NULL;
+    if (index_lookup(sector) == NULL) {
+      // drop the request rather than wait for a block
+      block = claim_entry(sector, CACHE_DATA, false);
+    }
+    if (block == NULL) {
+      lock_release(&global_cache_lock);
+      continue;
+    }
+    block->prefetched = true;
+    cache_readahead++;
+    lock_release(&global_cache_lock);
+
+    block_read(fs_device, sector, block->data);
+    cache_put(block, false);
+  }
+}
+
+/* Prints the replacement policy and hit statistics. */
+void cache_print_stats(void) {
+  printf("Cache (%s, %zu sectors): %zu accesses, %zu hits, "
+         "%zu read-ahead, %zu read-ahead hits\n",
+         policy->name, cache_size, cache_access, cache_hit,
+         cache_readahead, cache_readahead_hit);
+  static const char *class_names[CACHE_CLASS_CNT] = {
+    "inode", "indirect", "directory", "data"
+  };
+  printf("Cache hits by class:");
+  for (int i = 0; i < CACHE_CLASS_CNT; i++) {
+    printf(" %s %zu/%zu", class_names[i], cache_class_hit[i],
+           cache_class_access[i]);
+  }
+  printf("\n");
+  printf("Cache flushes: %zu, %zu blocks in %zu runs, %lld ticks\n",
+         cache_flush_cnt, cache_flush_blocks, cache_flush_runs,
+         cache_flush_ticks);
+}
+
+/* Times ITERATIONS lookups of resident sectors, once through the
+   sector index and once with the per-entry locked scan the cache
+   used before it had an index, and prints the cost of each.
+   Fills the cache from the start of the file system device first,
+   so it should be run on an otherwise idle file system. */
+void cache_benchmark(int iterations) {
+  char buff[BLOCK_SECTOR_SIZE];
+  block_sector_t resident = block_size(fs_device);
+  if (resident > cache_size) {
+    resident = cache_size;
+  }
+  for (block_sector_t s = 0; s < resident; s++) {
+    read_from_cache(s, buff);
+  }
+
+  // indexed lookup: one hash probe and at most one entry lock
+  int found = 0;
+  int64_t start = timer_ticks();
+  for (int i = 0; i < iterations; i++) {
+    lock_acquire(&global_cache_lock);
+    struct cache_entry *block = index_lookup(i % resident);
+    if (block != NULL && block->pin_cnt == 0) {
+      lock_acquire(&block->cache_lock);
+      found++;
+      lock_release(&block->cache_lock);
+    }
+    lock_release(&global_cache_lock);
+  }
+  int64_t indexed_ticks = timer_elapsed(start);
+
+  // linear scan: lock every entry just to compare its sector
+  start = timer_ticks();
+  for (int i = 0; i < iterations; i++) {
+    lock_acquire(&global_cache_lock);
+    for (size_t j = 0; j < counter; j++) {
+      struct cache_entry *block = &cache[j];
+      if (block->pin_cnt > 0) {
+        continue;
+      }
+      lock_acquire(&block->cache_lock);
+      bool match = block->sector == (block_sector_t) (i % resident);
+      lock_release(&block->cache_lock);
+      if (match) {
+        break;
+      }
+    }
+    lock_release(&global_cache_lock);
+  }
+  int64_t scan_ticks = timer_elapsed(start);
+
+  printf("cache lookup benchmark: %d lookups over %"PRDSNu" resident sectors "
+         "(%d found)\n", iterations, resident, found);
+  printf("  sector index: %lld ticks (%lld lookups/tick)\n",
+         indexed_ticks, indexed_ticks > 0 ? iterations / indexed_ticks : 0);
+  printf("  linear scan:  %lld ticks (%lld lookups/tick)\n",
+         scan_ticks, scan_ticks > 0 ? iterations / scan_ticks : 0);
+}
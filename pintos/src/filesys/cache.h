@@ -2,15 +2,71 @@
 #define FILESYS_CACHE_H
 
 #include "devices/block.h"
+
+/* Default number of cached sectors, overridable with -cache=N. */
 #define NUM_CACHE_ENTRIES 64
 
-struct cache_block;
+/* Smallest cache allowed, so that the blocks a thread pins at once
+   never exhaust it. */
+#define CACHE_MIN_ENTRIES 16
+
+/* Owner of blocks that belong to no inode. */
+#define CACHE_NO_OWNER ((block_sector_t) -1)
+
+struct cache_entry;
+
+/* What a cached sector holds.  Everything but CACHE_DATA is file
+   system metadata, which the cache keeps a minimum share of. */
+enum cache_class {
+  CACHE_INODE,  // an inode
+  CACHE_INDIRECT,  // an extent block
+  CACHE_DIRECTORY,  // directory contents
+  CACHE_DATA,  // regular file contents
+  CACHE_CLASS_CNT
+};
+
+/* How cache_get() fills a block. */
+enum cache_mode {
+  CACHE_READ,  // the sector's contents
+  CACHE_ZERO  // zeros, without reading the device
+};
 
-void initialize_cache(void);
+void initialize_cache(size_t entry_cnt);
+struct cache_entry *cache_get(block_sector_t sector, enum cache_class class,
+                              block_sector_t owner, enum cache_mode mode);
+void *cache_data(struct cache_entry *block);
+void cache_put(struct cache_entry *block, bool dirty);
+void cache_read_at(block_sector_t sector, enum cache_class class,
+                   size_t ofs, size_t len, void *buff);
+void cache_write_at(block_sector_t sector, enum cache_class class,
+                    block_sector_t owner, size_t ofs, size_t len,
+                    const void *buff);
 void read_from_cache(block_sector_t target_sector, void *buff);
 void write_to_cache(block_sector_t target_sector, void *buff);
 void flush_cache(void);
+void cache_sync(block_sector_t owner);
 bool reset_cache(void);
+bool cache_select_policy(const char *name);
+void cache_print_stats(void);
+void cache_read_ahead(block_sector_t sector);
+void cache_benchmark(int iterations);
+void cache_set_write_behind_hook(void (*hook)(void));
+
+/* Write-behind tunables; see cache.c. */
+extern int cache_flush_interval_ms;
+extern int cache_dirty_age_ms;
+extern int cache_dirty_ratio;
+
+/* Percentage of the cache reserved for metadata; see cache.c. */
+extern int cache_meta_pct;
+
+/* Per-class statistics; see cache.c. */
+extern size_t cache_class_access[CACHE_CLASS_CNT];
+extern size_t cache_class_hit[CACHE_CLASS_CNT];
+
+/* Read-ahead statistics; see cache.c. */
+extern size_t cache_readahead;
+extern size_t cache_readahead_hit;
 
 size_t cache_access;
 size_t cache_hit;
@@ -1,10 +1,13 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir
@@ -19,26 +22,154 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* Directory or file? */
   };
 
+/* A directory in the linear format, an array of entries, switches
+   to the hashed format once its first this many slots are in use.
+   A hashed directory is an array of buckets, one per sector, and a
+   name lives in the bucket its hash selects. */
+#define DIR_INDEX_MIN 64
+
+/* Entries per bucket of a hashed directory. */
+#define DIR_BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Most buckets a hashed directory may have. */
+#define DIR_MAX_BUCKETS 4096
+
+/* A bucket of a hashed directory.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - DIR_BUCKET_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+/* Directory entry cache: remembers, for a directory sector and a
+   name, the sector the name maps to or that the name does not
+   exist, so that repeated path resolution skips the directory
+   scan.  Each (parent, name) pair hashes to one slot, and a new
+   pair simply replaces whatever held the slot. */
+#define DCACHE_SIZE 256                 /* Number of slots; a power of 2. */
+#define DCACHE_NEGATIVE ((block_sector_t) -1) /* Child of a missing name. */
+
+struct dcache_entry
+  {
+    bool valid;                         /* Slot holds an entry? */
+    block_sector_t parent;              /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name within PARENT. */
+    block_sector_t child;               /* NAME's inode sector, or
+                                           DCACHE_NEGATIVE. */
+  };
+
+static struct dcache_entry dcache[DCACHE_SIZE];
+static struct lock dcache_lock;
+
+/* Incremented when a directory change starts and again when it
+   ends, and DCACHE_CHANGING counts the changes in progress, so that
+   a lookup that raced with one does not cache what it found: a
+   directory being changed may be read half updated. */
+static unsigned dcache_gen;
+static unsigned dcache_changing;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&dcache_lock);
+}
+
+/* Returns the dcache slot for NAME in the directory in sector
+   PARENT. */
+static struct dcache_entry *
+dcache_slot (block_sector_t parent, const char *name)
+{
+  return &dcache[(hash_string (name) ^ hash_int (parent))
+                 & (DCACHE_SIZE - 1)];
+}
+
+/* Looks up NAME in the directory in sector PARENT.  Returns true
+   and sets *CHILD to the cached sector, or DCACHE_NEGATIVE, on a
+   hit.  Returns false on a miss, setting *GEN for dcache_insert(). */
+static bool
+dcache_lookup (block_sector_t parent, const char *name,
+               block_sector_t *child, unsigned *gen)
+{
+  struct dcache_entry *d = dcache_slot (parent, name);
+  bool hit;
+
+  lock_acquire (&dcache_lock);
+  hit = d->valid && d->parent == parent && !strcmp (d->name, name);
+  if (hit)
+    *child = d->child;
+  *gen = dcache_gen;
+  lock_release (&dcache_lock);
+  return hit;
+}
+
+/* Records that NAME in the directory in sector PARENT maps to
+   CHILD, or DCACHE_NEGATIVE, as found by a lookup that started at
+   generation GEN.  Does nothing if a directory changed since, or is
+   being changed. */
+static void
+dcache_insert (block_sector_t parent, const char *name,
+               block_sector_t child, unsigned gen)
+{
+  struct dcache_entry *d = dcache_slot (parent, name);
+
+  lock_acquire (&dcache_lock);
+  if (gen == dcache_gen && dcache_changing == 0)
+    {
+      d->valid = true;
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      d->child = child;
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Called before a directory is changed, so that lookups stop
+   filling the dcache until the matching dcache_end_change(). */
+static void
+dcache_begin_change (void)
+{
+  lock_acquire (&dcache_lock);
+  dcache_gen++;
+  dcache_changing++;
+  lock_release (&dcache_lock);
+}
+
+/* Ends a change begun by dcache_begin_change().  Drops the entry
+   for NAME in the directory in sector PARENT, and if CHILD is not
+   DCACHE_NEGATIVE every entry within the directory in sector CHILD,
+   whose sector may be reused. */
+static void
+dcache_end_change (block_sector_t parent, const char *name,
+                   block_sector_t child)
+{
+  struct dcache_entry *d = dcache_slot (parent, name);
+  size_t i;
+
+  lock_acquire (&dcache_lock);
+  ASSERT (dcache_changing > 0);
+  dcache_gen++;
+  dcache_changing--;
+  if (d->valid && d->parent == parent && !strcmp (d->name, name))
+    d->valid = false;
+  if (child != DCACHE_NEGATIVE)
+    for (i = 0; i < DCACHE_SIZE; i++)
+      if (dcache[i].parent == child)
+        dcache[i].valid = false;
+  lock_release (&dcache_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  //return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
-  bool check = inode_create (sector, entry_cnt * sizeof (struct dir_entry));
-  if (check) {
-    struct inode *inode_opened = inode_open(sector);
-    if (inode_opened) {
-      struct inode_disk *disk_data = get_inode_disk(inode_opened);
-      set_is_dir(disk_data, true);
-      write_to_cache(sector, disk_data);
-    } else {
-      return false;
-    }
-  }
-  return check;
+  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 
@@ -108,6 +239,58 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Returns the number of buckets of DIR, which is hashed. */
+static size_t
+bucket_cnt (const struct dir *dir)
+{
+  return inode_length (dir->inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the byte offset of bucket IDX of a hashed directory. */
+static off_t
+bucket_ofs (size_t idx)
+{
+  return (off_t) idx * BLOCK_SECTOR_SIZE;
+}
+
+/* Returns the bucket that NAME belongs in among CNT buckets. */
+static size_t
+name_bucket (const char *name, size_t cnt)
+{
+  return hash_string (name) & (cnt - 1);
+}
+
+/* Searches DIR, which is hashed, for NAME, reading only the bucket
+   NAME hashes to.  Returns and fills in EP and OFSP as lookup()
+   does.  The bucket is read into the heap, not onto the stack. */
+static bool
+lookup_indexed (const struct dir *dir, const char *name,
+                struct dir_entry *ep, off_t *ofsp)
+{
+  size_t idx = name_bucket (name, bucket_cnt (dir));
+  struct dir_bucket *bucket;
+  bool found = false;
+  size_t i;
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+  if (inode_read_at (dir->inode, bucket, sizeof *bucket, bucket_ofs (idx))
+      == sizeof *bucket)
+    for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+      if (bucket->entries[i].in_use && !strcmp (name, bucket->entries[i].name))
+        {
+          if (ep != NULL)
+            *ep = bucket->entries[i];
+          if (ofsp != NULL)
+            *ofsp = bucket_ofs (idx) + i * sizeof (struct dir_entry);
+          found = true;
+          break;
+        }
+  free (bucket);
+  return found;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -123,6 +306,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (inode_is_indexed (dir->inode))
+    return lookup_indexed (dir, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e)
     if (e.in_use && !strcmp (name, e.name))
@@ -144,27 +330,213 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
+  block_sector_t parent = inode_get_inumber (dir->inode);
+  block_sector_t child;
   struct dir_entry e;
+  unsigned gen;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (!dcache_lookup (parent, name, &child, &gen))
+    {
+      child = lookup (dir, name, &e, NULL) ? e.inode_sector : DCACHE_NEGATIVE;
+      dcache_insert (parent, name, child, gen);
+    }
+
+  if (child != DCACHE_NEGATIVE)
+    *inode = inode_open (child);
   else
     *inode = NULL;
 
   return *inode != NULL;
 }
 
+/* Doubles the number of buckets of DIR, which is hashed, moving
+   each entry of bucket I whose hash now selects bucket I + CNT
+   there.  New buckets that receive no entries are left as holes.
+   Returns true if successful, false on failure. */
+static bool
+split_buckets (struct dir *dir)
+{
+  size_t cnt = bucket_cnt (dir);
+  struct dir_bucket *buckets;
+  bool success = false;
+  size_t idx, i;
+
+  if (cnt >= DIR_MAX_BUCKETS)
+    return false;
+  buckets = malloc (3 * sizeof *buckets);
+  if (buckets == NULL)
+    return false;
+
+  /* Grow the file by writing its new last bucket. */
+  memset (&buckets[0], 0, sizeof *buckets);
+  if (inode_write_at (dir->inode, &buckets[0], sizeof *buckets,
+                      bucket_ofs (2 * cnt - 1)) != sizeof *buckets)
+    goto done;
+
+  for (idx = 0; idx < cnt; idx++)
+    {
+      struct dir_bucket *old = &buckets[0];
+      struct dir_bucket *low = &buckets[1];
+      struct dir_bucket *high = &buckets[2];
+      size_t low_cnt = 0, high_cnt = 0;
+
+      if (inode_read_at (dir->inode, old, sizeof *old, bucket_ofs (idx))
+          != sizeof *old)
+        goto done;
+      memset (low, 0, sizeof *low);
+      memset (high, 0, sizeof *high);
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (old->entries[i].in_use)
+          {
+            if (name_bucket (old->entries[i].name, 2 * cnt) == idx)
+              low->entries[low_cnt++] = old->entries[i];
+            else
+              high->entries[high_cnt++] = old->entries[i];
+          }
+      if (high_cnt == 0)
+        continue;
+      if (inode_write_at (dir->inode, high, sizeof *high,
+                          bucket_ofs (idx + cnt)) != sizeof *high
+          || inode_write_at (dir->inode, low, sizeof *low, bucket_ofs (idx))
+             != sizeof *low)
+        goto done;
+    }
+  success = true;
+
+ done:
+  free (buckets);
+  return success;
+}
+
+/* Stores E in a free slot of the bucket of DIR, which is hashed,
+   that E's name selects, splitting buckets until one has room.
+   Returns true if successful, false on failure. */
+static bool
+add_indexed (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_bucket *bucket;
+  bool success = false;
+
+  bucket = malloc (sizeof *bucket);
+  if (bucket == NULL)
+    return false;
+  for (;;)
+    {
+      size_t idx = name_bucket (e->name, bucket_cnt (dir));
+      size_t i;
+
+      if (inode_read_at (dir->inode, bucket, sizeof *bucket, bucket_ofs (idx))
+          != sizeof *bucket)
+        break;
+      for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+        if (!bucket->entries[i].in_use)
+          break;
+      if (i < DIR_BUCKET_ENTRIES)
+        {
+          off_t ofs = bucket_ofs (idx) + i * sizeof *e;
+          success = (inode_write_at (dir->inode, e, sizeof *e, ofs)
+                     == sizeof *e);
+          break;
+        }
+      if (!split_buckets (dir))
+        break;
+    }
+  free (bucket);
+  return success;
+}
+
+/* Places the SLOTS entries at ENTRIES that are in use into the CNT
+   zeroed BUCKETS their names select.  Returns false if a bucket
+   overflows. */
+static bool
+fill_buckets (struct dir_bucket *buckets, size_t cnt,
+              const struct dir_entry *entries, size_t slots)
+{
+  size_t i, j;
+
+  for (i = 0; i < slots; i++)
+    if (entries[i].in_use)
+      {
+        struct dir_bucket *bucket = &buckets[name_bucket (entries[i].name,
+                                                          cnt)];
+        for (j = 0; j < DIR_BUCKET_ENTRIES; j++)
+          if (!bucket->entries[j].in_use)
+            break;
+        if (j == DIR_BUCKET_ENTRIES)
+          return false;
+        bucket->entries[j] = entries[i];
+      }
+  return true;
+}
+
+/* Converts DIR from the linear to the hashed format, with enough
+   buckets to fill them about half full.  Returns true if
+   successful, false on failure, in which case DIR is left as it
+   was. */
+static bool
+convert_to_indexed (struct dir *dir)
+{
+  off_t length = inode_length (dir->inode);
+  size_t slots = length / sizeof (struct dir_entry);
+  struct dir_entry *entries;
+  struct dir_bucket *buckets = NULL;
+  size_t cnt;
+  bool success = false;
+
+  for (cnt = 1; cnt * DIR_BUCKET_ENTRIES < 2 * slots; cnt *= 2)
+    continue;
+
+  entries = malloc (length);
+  if (entries == NULL)
+    goto done;
+  if (inode_read_at (dir->inode, entries, length, 0) != length)
+    goto done;
+
+  /* Lay the buckets out in memory, doubling their number whenever
+     one overflows. */
+  for (;;)
+    {
+      if (cnt > DIR_MAX_BUCKETS)
+        goto done;
+      buckets = calloc (cnt, sizeof *buckets);
+      if (buckets == NULL)
+        goto done;
+      if (fill_buckets (buckets, cnt, entries, slots))
+        break;
+      free (buckets);
+      buckets = NULL;
+      cnt *= 2;
+    }
+
+  /* Write them in a single call, which allocates every sector it
+     needs before overwriting any of the old entries, so that a full
+     disk leaves the linear directory intact.  The buckets cover
+     more bytes than the entries did, so they replace the old
+     contents completely. */
+  if (inode_write_at (dir->inode, buckets, cnt * sizeof *buckets, 0)
+      != (off_t) (cnt * sizeof *buckets))
+    goto done;
+  inode_set_indexed (dir->inode);
+  success = true;
+
+ done:
+  free (entries);
+  free (buckets);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and IS_DIR tells whether it is a directory.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
+         bool is_dir)
 {
   struct dir_entry e;
   off_t ofs;
@@ -177,29 +549,59 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  e.in_use = true;
+  strlcpy (e.name, name, sizeof e.name);
+  e.inode_sector = inode_sector;
+  e.is_dir = is_dir;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
+  /* A hashed directory checks NAME and finds room in the one bucket
+     NAME selects. */
+  dcache_begin_change ();
+  if (inode_is_indexed (dir->inode))
+    {
+      if (!lookup_indexed (dir, name, NULL, NULL))
+        success = add_indexed (dir, &e);
+      goto done;
+    }
+
+  /* In a linear directory, check that NAME is not in use and set OFS
+     to the offset of the first free slot in a single pass.  If there
+     are no free slots, then OFS will be set to the current
+     end-of-file.  A linear directory holds at most DIR_INDEX_MIN
+     entries, so the pass reads only a few sectors.
 
      inode_read_at() will only return a short read at end of file.
      Otherwise, we'd need to verify that we didn't get a short
      read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+  struct dir_entry slot;
+  off_t pos;
+  ofs = -1;
+  for (pos = 0;
+       inode_read_at (dir->inode, &slot, sizeof slot, pos) == sizeof slot;
+       pos += sizeof slot)
+    if (!slot.in_use)
+      {
+        if (ofs < 0)
+          ofs = pos;
+      }
+    else if (!strcmp (name, slot.name))
+      goto done;
+  if (ofs < 0)
+    ofs = pos;
+
+  /* A directory with no free slot among its first DIR_INDEX_MIN
+     switches to the hashed format instead. */
+  if (ofs / (off_t) sizeof e >= DIR_INDEX_MIN)
+    {
+      success = convert_to_indexed (dir) && add_indexed (dir, &e);
+      goto done;
+    }
 
   /* Write slot. */
-  e.in_use = true;
-  strlcpy (e.name, name, sizeof e.name);
-  e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
  done:
+  dcache_end_change (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
   return success;
 }
 
@@ -211,6 +613,7 @@ dir_remove (struct dir *dir, const char *name)
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  block_sector_t child = DCACHE_NEGATIVE;
   bool success = false;
   off_t ofs;
 
@@ -218,6 +621,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
+  dcache_begin_change ();
   if (!lookup (dir, name, &e, &ofs))
     goto done;
 
@@ -231,6 +635,7 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
     goto done;
+  child = e.inode_sector;
 
   /* Remove inode. */
   inode_remove (inode);
@@ -238,28 +643,89 @@ dir_remove (struct dir *dir, const char *name)
 
 
  done:
+  dcache_end_change (inode_get_inumber (dir->inode), name, child);
   inode_close (inode);
   return success;
 }
 
+/* Entries dir_read_batch() reads from the inode at a time. */
+#define DIR_READ_CHUNK (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Reads up to CNT of the entries that follow DIR's position into
+   RECORDS, skipping "." and "..", and advances the position past the
+   entries returned.  Entries are read from the inode a chunk at a
+   time rather than one by one.  Returns the number of entries read,
+   which is less than CNT only at the end of the directory. */
+size_t
+dir_read_batch (struct dir *dir, struct dir_record *records, size_t cnt)
+{
+  struct dir_entry one;
+  struct dir_entry *chunk;
+  size_t chunk_max = DIR_READ_CHUNK;
+  size_t filled = 0;
+
+  /* Read in chunks from the heap, not the stack, or one entry at a
+     time if memory is short. */
+  chunk = malloc (chunk_max * sizeof *chunk);
+  if (chunk == NULL)
+    {
+      chunk = &one;
+      chunk_max = 1;
+    }
+
+  while (filled < cnt)
+    {
+      size_t chunk_cnt = chunk_max;
+      size_t i;
+
+      /* In a hashed directory, stop at the unused tail of the bucket
+         and skip it. */
+      if (inode_is_indexed (dir->inode))
+        {
+          size_t slot = dir->pos % BLOCK_SECTOR_SIZE / sizeof *chunk;
+          if (slot >= DIR_BUCKET_ENTRIES)
+            {
+              dir->pos = ROUND_UP (dir->pos, BLOCK_SECTOR_SIZE);
+              slot = 0;
+            }
+          if (chunk_cnt > DIR_BUCKET_ENTRIES - slot)
+            chunk_cnt = DIR_BUCKET_ENTRIES - slot;
+        }
+
+      chunk_cnt = inode_read_at (dir->inode, chunk, chunk_cnt * sizeof *chunk,
+                                 dir->pos) / sizeof *chunk;
+      if (chunk_cnt == 0)
+        break;
+      for (i = 0; i < chunk_cnt && filled < cnt; i++)
+        {
+          struct dir_entry *e = &chunk[i];
+          dir->pos += sizeof *e;
+          if (e->in_use && strcmp (e->name, ".") && strcmp (e->name, ".."))
+            {
+              records[filled].inode_sector = e->inode_sector;
+              records[filled].is_dir = e->is_dir;
+              strlcpy (records[filled].name, e->name, NAME_MAX + 1);
+              filled++;
+            }
+        }
+    }
+  if (chunk != &one)
+    free (chunk);
+  return filled;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_record record;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
-    {
-      dir->pos += sizeof e;
-      if (e.in_use && (strcmp(e.name, ".") != 0 && strcmp(e.name, "..") != 0))
-        {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          return true;
-        }
-    }
-  return false;
+  if (dir_read_batch (dir, &record, 1) == 0)
+    return false;
+  strlcpy (name, record.name, NAME_MAX + 1);
+  return true;
 }
 
 
@@ -307,6 +773,10 @@ char *get_last_filename (struct resolve_metadata *metadata) {
 }
 
 
+// Resolves PATH, relative to DIR unless it starts with '/'.  On
+// success the caller owns the returned metadata's parent_dir and
+// last_inode, and must close both; last_inode is NULL when IS_MKDIR
+// and the last component does not exist yet.
 struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir) {
   char next_part[NAME_MAX + 1] = {0};
 
@@ -317,36 +787,46 @@ struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir
     return NULL;
   }
   struct resolve_metadata *result_metadata = malloc(sizeof(struct resolve_metadata));
+  if (result_metadata == NULL) {
+    return NULL;
+  }
 
 
   struct dir *parent_dir;
   char file_name[NAME_MAX + 1] = {0};
-  struct inode *inode;
+  struct inode *inode = NULL;
   bool inode_exists = false;
   bool isRoot = false;
+  // whether we hold our own reference to INODE, rather than borrowing
+  // the one PARENT_DIR holds
+  bool owned = false;
 
   if (path[0] == '/') {
     parent_dir = dir_open_root();
+    if (!parent_dir) {
+      free(result_metadata);
+      return NULL;
+    }
     isRoot = true;
     inode = parent_dir->inode;
     char rootName[1] = "/";
     strlcpy(file_name, rootName, 2);
   } else  {      
     parent_dir = dir_reopen(dir);
+    // a removed current directory has lost its "." entry
     inode_exists = dir_lookup(parent_dir, ".", &inode);
+    inode_close(inode);
+    inode = parent_dir->inode;
     if (!inode_exists) {
-      return NULL;
+      goto fail;
     }    
   }
 
-  if (!parent_dir) {
-    return NULL;
-  }
-
   int status = get_next_part(next_part, &path);
   
   while (status > 0) {
     inode_exists = dir_lookup(parent_dir, next_part, &inode);
+    owned = inode_exists;
 
     // take care of mkdir traversal
     if (is_mkdir) {
@@ -359,25 +839,31 @@ struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir
           strlcpy(result_metadata->last_file_name, next_part, sizeof(next_part) + 1);
           return result_metadata;
         } else {
-          return NULL;
+          goto fail;
         }
       } else {
         if (path[0] == '\0') {
-          return NULL;
+          goto fail;
         }
       }
     }
 
     if (!inode_exists) {
-      return NULL;
+      goto fail;
     }
     
 
-    if (inode_is_dir(get_inode_disk(inode)) || isRoot) {
+    if (inode_is_dir(inode) || isRoot) {
 
       if (path[0] != '\0') {
+        // the new parent takes over our reference
         dir_close(parent_dir);
         parent_dir = dir_open(inode);
+        owned = false;
+        if (!parent_dir) {
+          free(result_metadata);
+          return NULL;
+        }
       }
       
       strlcpy(file_name, next_part, sizeof(next_part)  + 1);
@@ -388,14 +874,19 @@ struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir
       char temp[NAME_MAX + 1] = {0};
       status = get_next_part(temp, &path);
       if (status != 0) {
-        return NULL;
+        goto fail;
       }
       strlcpy(file_name, next_part, sizeof(next_part) + 1);
     }
   }
 
   if (status != 0) {
-    return NULL;
+    goto fail;
+  }
+
+  // the path names PARENT_DIR itself (the root, or a trailing slash)
+  if (!owned) {
+    inode = inode_reopen(inode);
   }
 
   result_metadata->parent_dir = parent_dir;
@@ -403,11 +894,19 @@ struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir
   memset(result_metadata->last_file_name, 0, NAME_MAX + 1);
   strlcpy(result_metadata->last_file_name, file_name, sizeof(file_name) + 1);
   return result_metadata;
+
+ fail:
+  if (owned) {
+    inode_close(inode);
+  }
+  dir_close(parent_dir);
+  free(result_metadata);
+  return NULL;
 }
 
 
 void setup_dots_dir(block_sector_t sector, struct dir *parent_dir) {
   struct dir *child = dir_open(inode_open(sector));
-  dir_add(child, ".", sector);
-  dir_add(child, "..", inode_get_inumber(dir_get_inode(parent_dir)));
+  dir_add(child, ".", sector, true);
+  dir_add(child, "..", inode_get_inumber(dir_get_inode(parent_dir)), true);
 }
@@ -14,6 +14,16 @@
 struct inode;
 struct resolve_metadata;
 
+/* One entry returned by dir_read_batch(). */
+struct dir_record
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool is_dir;                        /* Directory or file? */
+  };
+
+void dir_init (void);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
 struct dir *dir_open (struct inode *);
@@ -24,9 +34,10 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, block_sector_t);
+bool dir_add (struct dir *, const char *name, block_sector_t, bool is_dir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_read_batch (struct dir *, struct dir_record *, size_t cnt);
 struct resolve_metadata *resolve_path(struct dir *dir, char *path, bool is_mkdir);
 
 struct dir *get_parent_dir (struct resolve_metadata *metadata);
@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
 #include "threads/thread.h"
 
 /* Partition that contains the file system. */
@@ -23,12 +24,14 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format)
     do_format ();
 
   free_map_open ();
+  cache_set_write_behind_hook (free_map_sync);
 
   struct dir* dir = dir_open_root();
   setup_dots_dir(ROOT_DIR_SECTOR, dir);
@@ -42,6 +45,8 @@ void
 filesys_done (void)
 {
   free_map_close ();
+  inode_flush ();
+  flush_cache ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -55,8 +60,8 @@ filesys_create (const char *name, off_t initial_size)
   struct dir *dir = dir_open_root();
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+                  && inode_create (inode_sector, initial_size, false)
+                  && dir_add (dir, name, inode_sector, false));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -80,8 +85,9 @@ filesys_create_file (const char *name, off_t initial_size)
 
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, get_last_filename(metadata), inode_sector));
+                  && inode_create (inode_sector, initial_size, false)
+                  && dir_add (dir, get_last_filename(metadata), inode_sector,
+                              false));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -97,7 +103,7 @@ filesys_create_dir (const char *name, off_t initial_size, struct dir* pDir)
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
                   && dir_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+                  && dir_add (dir, name, inode_sector, true));
 
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
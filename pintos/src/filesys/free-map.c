@@ -1,6 +1,9 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <limits.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -8,6 +11,10 @@
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *dirty_map;     /* Sectors of the free map file that
+                                        are behind FREE_MAP. */
+static block_sector_t cursor;        /* Where the next search without a
+                                        goal starts. */
 
 struct lock bitmap_lock;
 
@@ -20,15 +27,47 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
 
   lock_init(&bitmap_lock);
 }
 
+/* Marks the free map file sectors that hold the bits of the CNT
+   sectors starting at SECTOR as needing a write. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / CHAR_BIT / BLOCK_SECTOR_SIZE;
+  size_t last = (sector + cnt - 1) / CHAR_BIT / BLOCK_SECTOR_SIZE;
+  bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Finds CNT consecutive free sectors, searching from START and then
+   from the beginning of the disk, and marks them used.  Returns the
+   first sector, or BITMAP_ERROR if there is no such run. */
+static block_sector_t
+scan_from (block_sector_t start, size_t cnt)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  if (start < bitmap_size (free_map))
+    sector = bitmap_scan_and_flip (free_map, start, cnt, false);
+  if (sector == BITMAP_ERROR && start > 0)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    mark_dirty (sector, cnt);
+  return sector;
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The search starts where the last one
+   ended, so that allocations do not rescan the full start of the
+   disk.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The free map file is updated later, by
+   free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 { 
@@ -36,22 +75,73 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
     lock_acquire(&bitmap_lock);
   }
   
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector = scan_from (cursor, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      cursor = sector + cnt;
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
   if (lock_held_by_current_thread(&bitmap_lock)) {
     lock_release(&bitmap_lock);
   }
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates a run of up to CNT consecutive sectors, as close after
+   GOAL as possible, and stores the first into *SECTORP.  If no run
+   of CNT sectors is free, the run length is halved until one is.
+   Returns the number of sectors allocated, 0 if the disk is full. */
+size_t
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  if (!lock_held_by_current_thread(&bitmap_lock)) {
+    lock_acquire(&bitmap_lock);
+  }
+
+  block_sector_t sector = BITMAP_ERROR;
+  for (; cnt > 0; cnt /= 2)
+    {
+      sector = scan_from (goal, cnt);
+      if (sector != BITMAP_ERROR)
+        {
+          *sectorp = sector;
+          break;
+        }
+    }
+  if (lock_held_by_current_thread(&bitmap_lock)) {
+    lock_release(&bitmap_lock);
+  }
+  return cnt;
+}
+
+/* Allocates up to CNT free sectors starting at SECTOR, stopping at
+   the first one already in use.
+   Returns the number of sectors allocated, 0 if SECTOR itself is in
+   use. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  if (!lock_held_by_current_thread(&bitmap_lock)) {
+    lock_acquire(&bitmap_lock);
+  }
+
+  size_t size = bitmap_size (free_map);
+  size_t got = 0;
+  while (got < cnt && sector + got < size
+         && !bitmap_test (free_map, sector + got))
+    got++;
+  if (got > 0)
+    {
+      bitmap_set_multiple (free_map, sector, got, true);
+      mark_dirty (sector, got);
+    }
+  if (lock_held_by_current_thread(&bitmap_lock)) {
+    lock_release(&bitmap_lock);
+  }
+  return got;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
@@ -61,12 +151,51 @@ free_map_release (block_sector_t sector, size_t cnt)
   }
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
   if (lock_held_by_current_thread(&bitmap_lock)) {
     lock_release(&bitmap_lock);
   }
 }
 
+/* Writes the sectors of the free map file that changed since they
+   were last written.  Returns false if a write fails. */
+bool
+free_map_flush (void)
+{
+  bool success = true;
+
+  if (!lock_held_by_current_thread(&bitmap_lock)) {
+    lock_acquire(&bitmap_lock);
+  }
+  if (free_map_file != NULL)
+    {
+      size_t idx = 0;
+      while ((idx = bitmap_scan (dirty_map, idx, 1, true)) != BITMAP_ERROR)
+        {
+          if (!bitmap_write_range (free_map, free_map_file,
+                                   idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+            success = false;
+          bitmap_reset (dirty_map, idx);
+          idx++;
+        }
+    }
+  if (lock_held_by_current_thread(&bitmap_lock)) {
+    lock_release(&bitmap_lock);
+  }
+  return success;
+}
+
+/* Writes the free map through to the disk, so that the free map on
+   disk covers every allocation made so far.  Run before each
+   write-behind pass, so that no inode or extent block reaches the
+   disk pointing at sectors the disk still shows as free. */
+void
+free_map_sync (void)
+{
+  free_map_flush ();
+  cache_sync (FREE_MAP_SECTOR);
+}
+
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void)
@@ -81,6 +210,7 @@ free_map_open (void)
   if (!bitmap_read (free_map, free_map_file)) {
     PANIC ("can't read free map");
   }
+  bitmap_set_all (dirty_map, false);
   if (lock_held_by_current_thread(&bitmap_lock)) {
     lock_release(&bitmap_lock);
   }
@@ -93,7 +223,9 @@ free_map_close (void)
   if (!lock_held_by_current_thread(&bitmap_lock)) {
     lock_acquire(&bitmap_lock);
   }
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
   if (lock_held_by_current_thread(&bitmap_lock)) {
     lock_release(&bitmap_lock);
   }
@@ -108,7 +240,7 @@ free_map_create (void)
   if (!lock_held_by_current_thread(&bitmap_lock)) {
     lock_acquire(&bitmap_lock);
   }
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map))) {
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false)) {
     PANIC ("free map creation failed");
   }
 
@@ -120,6 +252,7 @@ free_map_create (void)
   if (!bitmap_write (free_map, free_map_file)) {
     PANIC ("can't write free map");
   }
+  bitmap_set_all (dirty_map, false);
   if (lock_held_by_current_thread(&bitmap_lock)) {
     lock_release(&bitmap_lock);
   }
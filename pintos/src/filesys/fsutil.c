@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
@@ -221,3 +222,11 @@ fsutil_append (char **argv)
   file_close (src);
   free (buffer);
 }
+
+/* Times buffer cache lookups and prints the per-lookup cost. */
+void
+fsutil_cachebench (char **argv UNUSED)
+{
+  printf ("Benchmarking buffer cache lookups...\n");
+  cache_benchmark (100000);
+}
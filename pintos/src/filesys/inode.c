@@ -1,44 +1,81 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "filesys/cache.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-#define NUM_DIRECT_POINTERS 12
-#define NUM_POINTERS_PER_INDIRECT BLOCK_SECTOR_SIZE / sizeof(block_sector_t)
+/* Extents stored in the inode itself and in each extent block. */
+#define INODE_EXTENT_CNT 40
+#define EXTENT_BLOCK_CNT 42
+
+/* Largest file kept inline, in the inode sector itself. */
+#define INODE_INLINE_MAX 500
+
+/* Initial number of chains in the open inode table.  Must be a
+   power of 2.  The table doubles whenever it holds more than
+   OPEN_INODE_LOAD inodes per chain. */
+#define OPEN_INODE_BUCKETS 64
+#define OPEN_INODE_LOAD 2
+
+/* Read-ahead window bounds, in sectors. */
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 16
+
+/* A run of LENGTH consecutive device sectors starting at START,
+   holding the file sectors starting at LOGICAL. */
+struct extent
+  {
+    uint32_t logical;                   /* First file sector. */
+    block_sector_t start;               /* First device sector. */
+    uint32_t length;                    /* Number of sectors. */
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-
-    // block_sector_t start;               /* First data sector. */
-    block_sector_t direct_pointers[NUM_DIRECT_POINTERS];
-    block_sector_t indirect_pointer;
-    block_sector_t doubly_indirect_pointer;
-
-    bool is_dir;
-
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[111];               /* Not used. */
+    bool is_dir;                        /* True for a directory. */
+    bool is_inline;                     /* True if the data is in
+                                           INLINE_DATA. */
+    bool is_indexed;                    /* True for a directory in the
+                                           hashed format. */
+    union
+      {
+        /* Block-mapped data. */
+        struct
+          {
+            uint32_t extent_cnt;        /* Number of extents in use. */
+            block_sector_t extent_block; /* First extent block, or 0. */
+            struct extent extents[INODE_EXTENT_CNT]; /* First extents,
+                                           in file order.  File sectors
+                                           between them are holes. */
+          };
+
+        /* Inline data, for files of at most INODE_INLINE_MAX bytes. */
+        uint8_t inline_data[INODE_INLINE_MAX];
+      };
   };
 
-bool inode_is_dir(struct inode_disk *disk_data) {
-  return disk_data->is_dir;
-}
-
-
-struct indirect_disk {
-  block_sector_t pointers[NUM_POINTERS_PER_INDIRECT];
-};
+/* Extents past the first INODE_EXTENT_CNT, in a chain of sectors.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct extent_block
+  {
+    block_sector_t next;                /* Next extent block, or 0. */
+    uint32_t unused;                    /* Not used. */
+    struct extent extents[EXTENT_BLOCK_CNT];
+  };
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -51,11 +88,25 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem elem;              /* Element in open inode chain. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t ra_last;                      /* Last file sector read, or -1. */
+    off_t ra_next;                      /* First file sector not yet queued
+                                           for read-ahead. */
+    int ra_window;                      /* Sectors to read ahead, 0 if the
+                                           access pattern is not sequential. */
+    struct lock lock;                   /* Serializes growth. */
+    struct inode_disk data;             /* Inode content, authoritative
+                                           while the inode is open. */
+    bool dirty;                         /* DATA differs from the disk
+                                           inode. */
+    bool loading;                       /* DATA is still being read by the
+                                           first opener. */
+    struct list_elem flush_elem;        /* Element in inode_flush()'s
+                                           list. */
   };
 
 int inode_get_open_cnt(struct inode *inode) {
@@ -63,251 +114,648 @@ int inode_get_open_cnt(struct inode *inode) {
 }
 
 
-struct inode_disk *get_inode_disk(struct inode *inode) {
-  char buffer[BLOCK_SECTOR_SIZE];
-  memset(buffer, 0, BLOCK_SECTOR_SIZE);
-  read_from_cache(inode->sector, buffer);
-  struct inode_disk *result = (struct inode_disk *) buffer;
-  return result;
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (struct inode *inode)
+{
+  return inode->data.is_dir;
+}
+
+/* Returns true if INODE is a directory in the hashed format. */
+bool
+inode_is_indexed (struct inode *inode)
+{
+  return inode->data.is_indexed;
 }
 
-struct indirect_disk *get_indirect_disk(block_sector_t sector_number) {
-  char buffer[BLOCK_SECTOR_SIZE];
-  memset(buffer, 0, BLOCK_SECTOR_SIZE);
-  read_from_cache(sector_number, buffer);
-  struct indirect_disk *result = (struct indirect_disk *) buffer;
-  return result;
+/* Records that INODE, a directory, now uses the hashed format. */
+void
+inode_set_indexed (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+  inode->data.is_indexed = true;
+  inode->dirty = true;
+  lock_release (&inode->lock);
 }
 
-void set_is_dir(struct inode_disk* disk_data, bool value) {
-  disk_data->is_dir = value;
+/* Returns the cache class of INODE's data sectors. */
+static enum cache_class
+data_class (const struct inode *inode)
+{
+  return inode->data.is_dir ? CACHE_DIRECTORY : CACHE_DATA;
 }
 
-/* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
-static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+/* Returns the index of the first of the CNT extents at EXTENTS that
+   ends past file sector IDX, or CNT if none does. */
+static size_t
+first_ending_after (const struct extent *extents, size_t cnt, size_t idx)
 {
-  ASSERT (inode != NULL);
+  size_t lo = 0, hi = cnt;
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extents[mid].logical + extents[mid].length <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
 
-  struct inode_disk *disk_data = get_inode_disk(inode);
+/* Returns the number of extents of DISK_DATA held in its extent
+   block N. */
+static size_t
+extents_in_block (const struct inode_disk *disk_data, size_t n)
+{
+  size_t cnt = disk_data->extent_cnt - INODE_EXTENT_CNT - n * EXTENT_BLOCK_CNT;
+  return cnt < EXTENT_BLOCK_CNT ? cnt : EXTENT_BLOCK_CNT;
+}
 
-  if (pos < 0) {
-    return -1;
-  }
+/* Returns the sector of extent block N of DISK_DATA. */
+static block_sector_t
+extent_block_sector (const struct inode_disk *disk_data, size_t n)
+{
+  block_sector_t sector = disk_data->extent_block;
+  while (n-- > 0)
+    cache_read_at (sector, CACHE_INDIRECT, offsetof (struct extent_block, next),
+                   sizeof sector, &sector);
+  return sector;
+}
 
-  if (pos < disk_data->length) {
+/* Walks the sectors of an inode in file order.  Each extent, or
+   hole between extents, is looked up once and its whole run handed
+   out sector by sector.
+   While the walk is in the extent blocks, the current one stays
+   pinned in the cache, so stepping to the next extent costs no
+   lookup. */
+struct block_map
+  {
+    const struct inode_disk *disk_data; /* Inode being walked. */
+    size_t idx;                         /* Next file sector. */
+    size_t n;                           /* Next extent to look up. */
+    block_sector_t run;                 /* Device sector of IDX, 0 in a
+                                           hole. */
+    size_t run_left;                    /* Sectors left in RUN, or 0. */
+    struct cache_entry *block;          /* Pinned extent block, or null. */
+    size_t block_n;                     /* Number of BLOCK. */
+  };
 
-    // check if position is in one of the 12 direct blocks
-    if (pos < NUM_DIRECT_POINTERS * BLOCK_SECTOR_SIZE) {
-      int direct_index = pos / BLOCK_SECTOR_SIZE;
-      block_sector_t result_sector = disk_data->direct_pointers[direct_index];
-      return result_sector;
+/* Returns extent N of MAP's inode, pinning the extent block that
+   holds it in place of the one pinned before. */
+static const struct extent *
+map_extent (struct block_map *map, size_t n)
+{
+  if (n < INODE_EXTENT_CNT)
+    return &map->disk_data->extents[n];
 
-    // check if position is in one of the blocks in the indirect pointer
-    } else if (pos < NUM_DIRECT_POINTERS*BLOCK_SECTOR_SIZE + NUM_POINTERS_PER_INDIRECT*BLOCK_SECTOR_SIZE) {
-      block_sector_t indirect_sector = disk_data->indirect_pointer;
-      struct indirect_disk *indirect_block = get_indirect_disk(indirect_sector);
-      int idx = (pos / BLOCK_SECTOR_SIZE);
-      int indirect_index = idx - NUM_DIRECT_POINTERS;
-      block_sector_t result_sector = indirect_block->pointers[indirect_index];
-      return result_sector;
+  size_t block_n = (n - INODE_EXTENT_CNT) / EXTENT_BLOCK_CNT;
+  if (map->block == NULL || map->block_n != block_n)
+    {
+      block_sector_t sector;
+      if (map->block != NULL && map->block_n + 1 == block_n)
+        {
+          const struct extent_block *eb = cache_data (map->block);
+          sector = eb->next;
+          cache_put (map->block, false);
+        }
+      else
+        {
+          /* Unpin first, since the chain walk may pass through the
+             block held. */
+          if (map->block != NULL)
+            cache_put (map->block, false);
+          sector = extent_block_sector (map->disk_data, block_n);
+        }
+      map->block = cache_get (sector, CACHE_INDIRECT, CACHE_NO_OWNER,
+                              CACHE_READ);
+      map->block_n = block_n;
+    }
+  const struct extent_block *eb = cache_data (map->block);
+  return &eb->extents[(n - INODE_EXTENT_CNT) % EXTENT_BLOCK_CNT];
+}
 
-    // position is in one of the blocks in the doubly indirect pointer
-    } else {
-      block_sector_t doubly_indirect_sector = disk_data->doubly_indirect_pointer;
-      struct indirect_disk *doubly_indirect_block = get_indirect_disk(doubly_indirect_sector);
+/* Starts MAP at file sector IDX of DISK_DATA. */
+static void
+map_begin (struct block_map *map, const struct inode_disk *disk_data,
+           size_t idx)
+{
+  size_t cnt = disk_data->extent_cnt;
+  size_t in_inode = cnt < INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT;
+  size_t k;
 
-      // get the appropriate singly indirect block
-      int sector_idx = pos / BLOCK_SECTOR_SIZE;
-      int doubly_indirect_index = (sector_idx - (NUM_DIRECT_POINTERS + NUM_POINTERS_PER_INDIRECT)) / NUM_POINTERS_PER_INDIRECT;
+  map->disk_data = disk_data;
+  map->idx = idx;
+  map->run_left = 0;
+  map->block = NULL;
 
-      if(doubly_indirect_index < 0) {
-        doubly_indirect_index = 0;
-      }
+  k = first_ending_after (disk_data->extents, in_inode, idx);
+  if (k < in_inode)
+    {
+      map->n = k;
+      return;
+    }
 
-      block_sector_t indirect_sector = doubly_indirect_block->pointers[doubly_indirect_index];
-      struct indirect_disk *indirect_block = get_indirect_disk(indirect_sector);
+  /* Search only the extent block whose range covers IDX. */
+  for (size_t n = INODE_EXTENT_CNT; n < cnt; n += EXTENT_BLOCK_CNT)
+    {
+      size_t in_block = cnt - n < EXTENT_BLOCK_CNT ? cnt - n : EXTENT_BLOCK_CNT;
+      const struct extent *first = map_extent (map, n);
+      k = first_ending_after (first, in_block, idx);
+      if (k < in_block)
+        {
+          map->n = n + k;
+          return;
+        }
+    }
+  map->n = cnt;
+}
 
-      // get the appropriate data block
-      int indirect_index = (sector_idx - (12 + 128));
+/* Returns the device sector holding MAP's next file sector and
+   advances MAP past it.  Returns 0, which is never a data sector,
+   if that file sector lies in a hole. */
+static block_sector_t
+map_next (struct block_map *map)
+{
+  if (map->run_left == 0)
+    {
+      size_t cnt = map->disk_data->extent_cnt;
+      const struct extent *e = NULL;
 
-      if(indirect_index < 0) {
-        indirect_index = 0;
-      }
-      indirect_index =  indirect_index % 128;
+      /* Skip extents that end before IDX, which an extent inserted
+         since the last step can leave behind. */
+      for (; map->n < cnt; map->n++)
+        {
+          e = map_extent (map, map->n);
+          if (e->logical + e->length > map->idx)
+            break;
+        }
 
-      block_sector_t result_sector = indirect_block->pointers[indirect_index];
-      return result_sector;
+      if (map->n >= cnt)
+        {
+          map->run = 0;
+          map->run_left = 1;
+        }
+      else if (map->idx < e->logical)
+        {
+          map->run = 0;
+          map->run_left = e->logical - map->idx;
+        }
+      else
+        {
+          map->run = e->start + (map->idx - e->logical);
+          map->run_left = e->logical + e->length - map->idx;
+          map->n++;
+        }
     }
-
-  } else {
-    // free(disk_data);
-    return -1;
-  }
+  map->idx++;
+  map->run_left--;
+  return map->run != 0 ? map->run++ : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Ends the walk of MAP, unpinning its extent block. */
+static void
+map_end (struct block_map *map)
+{
+  if (map->block != NULL)
+    cache_put (map->block, false);
+}
 
-/* Initializes the inode module. */
-void
-inode_init (void)
+/* Copies extent N of DISK_DATA into *E. */
+static void
+read_extent (const struct inode_disk *disk_data, size_t n, struct extent *e)
 {
-  list_init (&open_inodes);
+  if (n < INODE_EXTENT_CNT)
+    *e = disk_data->extents[n];
+  else
+    {
+      n -= INODE_EXTENT_CNT;
+      cache_read_at (extent_block_sector (disk_data, n / EXTENT_BLOCK_CNT),
+                     CACHE_INDIRECT,
+                     offsetof (struct extent_block, extents)
+                     + n % EXTENT_BLOCK_CNT * sizeof *e,
+                     sizeof *e, e);
+    }
 }
 
-/* Initializes an inode with LENGTH bytes of data and
-   writes the new inode to sector SECTOR on the file system
-   device.
-   Returns true if successful.
-   Returns false if memory or disk allocation fails. */
-bool
-inode_create (block_sector_t sector, off_t length)
+/* Stores *E as extent N of DISK_DATA, the inode in sector OWNER. */
+static void
+write_extent (struct inode_disk *disk_data, block_sector_t owner, size_t n,
+              const struct extent *e)
 {
-  struct inode_disk *disk_inode = NULL;
-  bool success = true;
+  if (n < INODE_EXTENT_CNT)
+    disk_data->extents[n] = *e;
+  else
+    {
+      n -= INODE_EXTENT_CNT;
+      cache_write_at (extent_block_sector (disk_data, n / EXTENT_BLOCK_CNT),
+                      CACHE_INDIRECT, owner,
+                      offsetof (struct extent_block, extents)
+                      + n % EXTENT_BLOCK_CNT * sizeof *e,
+                      sizeof *e, e);
+    }
+}
 
-  ASSERT (length >= 0);
+/* Allocates a sector to hold CLASS for the inode in sector OWNER,
+   stores its number in *SECTOR and zeroes it in the cache, without
+   reading the device. */
+static bool
+allocate_zeroed (block_sector_t *sector, enum cache_class class,
+                 block_sector_t owner)
+{
+  if (!free_map_allocate (1, sector))
+    return false;
+  cache_put (cache_get (*sector, class, owner, CACHE_ZERO), true);
+  return true;
+}
 
+/* Returns the index of the first extent of DISK_DATA that ends past
+   file sector IDX, or the number of extents if none does. */
+static size_t
+find_extent (const struct inode_disk *disk_data, size_t idx)
+{
+  size_t lo = 0, hi = disk_data->extent_cnt;
+  struct extent e;
 
-  /* If this assertion fails, the inode structure is not exactly
-     one sector in size, and you should fix that. */
-  ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      read_extent (disk_data, mid, &e);
+      if (e.logical + e.length <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
 
-  disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL) {
+/* Returns true if file sectors START up to END of DISK_DATA all lie
+   in one extent. */
+static bool
+range_mapped (const struct inode_disk *disk_data, size_t start, size_t end)
+{
+  size_t n = find_extent (disk_data, start);
+  struct extent e;
+
+  if (start >= end)
+    return true;
+  if (n >= disk_data->extent_cnt)
+    return false;
+  read_extent (disk_data, n, &e);
+  return e.logical <= start && end <= e.logical + e.length;
+}
 
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      disk_inode->is_dir = false;
+/* Maps the LENGTH device sectors starting at START as file sectors
+   starting at LOGICAL of DISK_DATA, the inode in sector OWNER, as
+   extent N.  The run joins extent N - 1 or N if it continues one of
+   them; otherwise later extents move up to make room, along with a
+   new extent block if the last one is full. */
+static bool
+insert_extent (struct inode_disk *disk_data, block_sector_t owner, size_t n,
+               size_t logical, block_sector_t start, size_t length)
+{
+  size_t cnt = disk_data->extent_cnt;
+  struct extent e;
 
-      if (sectors == 0) {
-        write_to_cache(sector, disk_inode);
-        free(disk_inode);
-        return success;
-      }
+  if (n > 0)
+    {
+      read_extent (disk_data, n - 1, &e);
+      if (e.start + e.length == start && e.logical + e.length == logical)
+        {
+          e.length += length;
+          write_extent (disk_data, owner, n - 1, &e);
+          return true;
+        }
+    }
+  if (n < cnt)
+    {
+      read_extent (disk_data, n, &e);
+      if (start + length == e.start && logical + length == e.logical)
+        {
+          e.logical = logical;
+          e.start = start;
+          e.length += length;
+          write_extent (disk_data, owner, n, &e);
+          return true;
+        }
+    }
 
-      int num = sectors;
-      if (sectors > 12) {
-        num = 12;
-      }
+  if (cnt >= INODE_EXTENT_CNT
+      && (cnt - INODE_EXTENT_CNT) % EXTENT_BLOCK_CNT == 0)
+    {
+      block_sector_t block;
+      if (!allocate_zeroed (&block, CACHE_INDIRECT, owner))
+        return false;
+      if (cnt == INODE_EXTENT_CNT)
+        disk_data->extent_block = block;
+      else
+        cache_write_at (extent_block_sector (disk_data,
+                                             (cnt - INODE_EXTENT_CNT)
+                                             / EXTENT_BLOCK_CNT - 1),
+                        CACHE_INDIRECT, owner,
+                        offsetof (struct extent_block, next), sizeof block,
+                        &block);
+    }
 
-      // create direct data blocks
-      for (int i = 0; i < num; i++) {
-        if (!free_map_allocate (1, &disk_inode->direct_pointers[i])) {
-          free(disk_inode);
-          return false;
-        }
-        char zeros[BLOCK_SECTOR_SIZE];
-        memset(zeros, 0, BLOCK_SECTOR_SIZE);
-        write_to_cache(disk_inode->direct_pointers[i], zeros);
-      }
+  /* Readers do not lock the map, so it is kept sorted and complete
+     throughout: later extents are copied up from the end, the count
+     grows once the last one is duplicated, and only then is the new
+     extent stored.  An appended extent is counted after it is
+     stored. */
+  for (size_t i = cnt; i > n; i--)
+    {
+      read_extent (disk_data, i - 1, &e);
+      write_extent (disk_data, owner, i, &e);
+    }
+  if (n < cnt)
+    disk_data->extent_cnt = cnt + 1;
+  e.logical = logical;
+  e.start = start;
+  e.length = length;
+  write_extent (disk_data, owner, n, &e);
+  disk_data->extent_cnt = cnt + 1;
+  return true;
+}
 
-      struct indirect_disk *direct_pointers = malloc(sizeof(struct indirect_disk));
-      // memset(direct_pointers->pointers, 0, NUM_POINTERS_PER_INDIRECT * sizeof(block_sector_t));
+/* Allocates sectors for the holes among the file sectors that bytes
+   OFFSET up to OFFSET + SIZE of the inode DISK_DATA in sector OWNER
+   touch.  Each run is placed where it would continue the extent
+   before it, if those sectors are free, or else as near there (or
+   after the inode, for a file with no earlier extent) as the free
+   map has one.  Only a new sector that the byte range covers in
+   part is zeroed; the caller is about to overwrite the others
+   completely, and zeroing them too would cost a device write
+   apiece. */
+static bool
+allocate_sectors (struct inode_disk *disk_data, block_sector_t owner,
+                  off_t offset, off_t size)
+{
+  enum cache_class class = disk_data->is_dir ? CACHE_DIRECTORY : CACHE_DATA;
+  size_t start = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
+  struct extent e;
 
-      if (sectors > 12) {
-        if (!free_map_allocate (1, &disk_inode->indirect_pointer)) {
-          free(direct_pointers);
-          // free(zeros);
-          free(disk_inode);
-          return false;
+  while (start < end)
+    {
+      /* Find the hole at START, skipping any extent there. */
+      size_t n = find_extent (disk_data, start);
+      size_t hole_end = end;
+      if (n < disk_data->extent_cnt)
+        {
+          read_extent (disk_data, n, &e);
+          if (e.logical <= start)
+            {
+              start = e.logical + e.length;
+              continue;
+            }
+          if (e.logical < hole_end)
+            hole_end = e.logical;
         }
 
-        num = sectors - NUM_DIRECT_POINTERS;
-        if (num > NUM_POINTERS_PER_INDIRECT) {
-          num = NUM_POINTERS_PER_INDIRECT;
+      block_sector_t sector = owner + 1 + start;
+      size_t cnt = 0;
+      if (n > 0)
+        {
+          read_extent (disk_data, n - 1, &e);
+          sector = e.start + (start - e.logical);
+          cnt = free_map_allocate_at (sector, hole_end - start);
         }
-        for (int i = 0; i < num; i++) {
-          if (!free_map_allocate (1, &direct_pointers->pointers[i])) {
-            free(direct_pointers);
-            free(disk_inode);
+      if (cnt == 0)
+        {
+          cnt = free_map_allocate_near (sector, hole_end - start, &sector);
+          if (cnt == 0)
             return false;
-          }
-          
-          char zeros[BLOCK_SECTOR_SIZE];
-          memset(zeros, 0, BLOCK_SECTOR_SIZE);
-          write_to_cache(direct_pointers->pointers[i], zeros);
         }
 
-        write_to_cache(disk_inode->indirect_pointer,  direct_pointers);
-      }
+      for (size_t i = 0; i < cnt; i++)
+        {
+          off_t sector_ofs = (off_t) (start + i) * BLOCK_SECTOR_SIZE;
+          if (sector_ofs < offset
+              || sector_ofs + BLOCK_SECTOR_SIZE > offset + size)
+            cache_put (cache_get (sector + i, class, owner, CACHE_ZERO),
+                       true);
+        }
 
-      free(direct_pointers);
+      if (!insert_extent (disk_data, owner, n, start, sector, cnt))
+        {
+          free_map_release (sector, cnt);
+          return false;
+        }
+      start += cnt;
+    }
+  return true;
+}
 
+/* Moves the inline data of INODE into a data sector of its own and
+   switches INODE to block-mapped storage, so that it can grow past
+   INODE_INLINE_MAX bytes.  INODE's lock must be held.  Returns
+   false if no sector is free. */
+static bool
+migrate_inline (struct inode *inode)
+{
+  struct inode_disk *disk_data = &inode->data;
+  block_sector_t sector = 0;
 
-      int sectors_left = sectors - (NUM_DIRECT_POINTERS + NUM_POINTERS_PER_INDIRECT);
-      if (sectors_left < 0) {
-        sectors_left = 0;
-      }
+  if (disk_data->length > 0)
+    {
+      if (free_map_allocate_near (inode->sector + 1, 1, &sector) == 0)
+        return false;
+      struct cache_entry *block = cache_get (sector, data_class (inode),
+                                             inode->sector, CACHE_ZERO);
+      memcpy (cache_data (block), disk_data->inline_data,
+              disk_data->length);
+      cache_put (block, true);
+    }
 
-      int num_indirects = DIV_ROUND_UP(sectors_left, NUM_POINTERS_PER_INDIRECT);
-      struct indirect_disk *indirect_pointers = malloc(sizeof(struct indirect_disk)); 
-      // memset(indirect_pointers, 0, sizeof(struct indirect_disk));
-      
-      // struct indirect_disk data_pointers[num_indirects];
-      struct indirect_disk *data_pointers = malloc(sizeof(struct indirect_disk) * num_indirects);
-      // data_pointers->pointers = malloc(NUM_POINTERS_PER_INDIRECT * sizeof(block_sector_t));
-
-      if (sectors > NUM_DIRECT_POINTERS + NUM_POINTERS_PER_INDIRECT) {
-        if (!free_map_allocate (1, &disk_inode->doubly_indirect_pointer)) {
-          free(indirect_pointers);
-          free(data_pointers);
-          // free(zeros);
-          free(disk_inode);
-          return false;
-        }
+  memset (disk_data->inline_data, 0, sizeof disk_data->inline_data);
+  if (sector != 0)
+    {
+      disk_data->extents[0].logical = 0;
+      disk_data->extents[0].start = sector;
+      disk_data->extents[0].length = 1;
+      disk_data->extent_cnt = 1;
+    }
+  disk_data->is_inline = false;
+  inode->dirty = true;
+  return true;
+}
 
-        for (int i = 0; i < num_indirects; i++) {
-          int num_left = sectors_left;
-          if (sectors_left > NUM_POINTERS_PER_INDIRECT) {
-            num_left = NUM_POINTERS_PER_INDIRECT;
-          }
+/* Releases the data sectors of the inode DISK_DATA and the extent
+   blocks that map them. */
+static void
+release_sectors (const struct inode_disk *disk_data)
+{
+  if (disk_data->is_inline)
+    return;
 
-          if (!free_map_allocate (1, indirect_pointers->pointers + i)) {
-            free(indirect_pointers);
-            free(data_pointers);
-            // free(zeros);
-            free(disk_inode);
-            return false;
-          }
+  size_t cnt = disk_data->extent_cnt;
+  for (size_t n = 0; n < cnt && n < INODE_EXTENT_CNT; n++)
+    free_map_release (disk_data->extents[n].start,
+                      disk_data->extents[n].length);
 
+  block_sector_t sector = disk_data->extent_block;
+  for (size_t n = 0; cnt > INODE_EXTENT_CNT + n * EXTENT_BLOCK_CNT; n++)
+    {
+      struct cache_entry *block = cache_get (sector, CACHE_INDIRECT,
+                                             CACHE_NO_OWNER, CACHE_READ);
+      const struct extent_block *eb = cache_data (block);
+      size_t in_block = extents_in_block (disk_data, n);
+      for (size_t i = 0; i < in_block; i++)
+        free_map_release (eb->extents[i].start, eb->extents[i].length);
+      block_sector_t next = eb->next;
+      cache_put (block, false);
+      free_map_release (sector, 1);
+      sector = next;
+    }
+}
 
-          for (int j = 0; j < num_left; j++) {
-            if (!free_map_allocate (1, &((data_pointers + i)->pointers[j]))) {
-              free(indirect_pointers);
-              free(data_pointers);
-              // free(zeros);
-              free(disk_inode);
-              return false;
-            }
-            char zeros[BLOCK_SECTOR_SIZE];
-            memset(zeros, 0, BLOCK_SECTOR_SIZE);
-            write_to_cache(data_pointers[i].pointers[j], zeros);
-            sectors_left--;
-          }
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK guards
+   the chains and every open_cnt, but is never held across device
+   I/O; INODE_LOADED is signaled when an inode finishes loading. */
+static struct list *open_inodes;
+static size_t open_inode_buckets;       /* Number of chains. */
+static size_t open_inode_cnt;           /* Number of inodes in the table. */
+static struct lock open_inodes_lock;
+static struct condition inode_loaded;
+
+/* Serializes inode_flush() calls, which share flush_elem. */
+static struct lock inode_flush_lock;
+
+/* Returns the chain of open inodes that SECTOR hashes to.
+   OPEN_INODES_LOCK must be held. */
+static struct list *
+open_inode_chain (block_sector_t sector)
+{
+  return &open_inodes[hash_int (sector) & (open_inode_buckets - 1)];
+}
 
-          write_to_cache(indirect_pointers->pointers[i], &data_pointers[i]);
-        }
+/* Doubles the number of chains of the open inode table, moving every
+   inode to its new chain.  Keeps the old chains if memory is short.
+   OPEN_INODES_LOCK must be held. */
+static void
+grow_open_inodes (void)
+{
+  struct list *old = open_inodes;
+  size_t old_buckets = open_inode_buckets;
+  size_t i;
 
-        write_to_cache(disk_inode->doubly_indirect_pointer, indirect_pointers);   
+  open_inodes = malloc (2 * old_buckets * sizeof *open_inodes);
+  if (open_inodes == NULL)
+    {
+      open_inodes = old;
+      return;
+    }
+  open_inode_buckets = 2 * old_buckets;
+  for (i = 0; i < open_inode_buckets; i++)
+    list_init (&open_inodes[i]);
+  for (i = 0; i < old_buckets; i++)
+    while (!list_empty (&old[i]))
+      {
+        struct inode *inode = list_entry (list_pop_front (&old[i]),
+                                          struct inode, elem);
+        list_push_front (open_inode_chain (inode->sector), &inode->elem);
       }
+  free (old);
+}
 
-      free(indirect_pointers);
-      free(data_pointers);
+/* Initializes the inode module. */
+void
+inode_init (void)
+{
+  size_t i;
+
+  open_inode_buckets = OPEN_INODE_BUCKETS;
+  open_inodes = malloc (open_inode_buckets * sizeof *open_inodes);
+  if (open_inodes == NULL)
+    PANIC ("open inode table allocation failed");
+  for (i = 0; i < open_inode_buckets; i++)
+    list_init (&open_inodes[i]);
+  open_inode_cnt = 0;
+  lock_init (&open_inodes_lock);
+  cond_init (&inode_loaded);
+  lock_init (&inode_flush_lock);
+}
 
-      write_to_cache(sector, disk_inode);
+/* Initializes an inode with LENGTH bytes of data and
+   writes the new inode to sector SECTOR on the file system
+   device.  IS_DIR tells whether the inode holds a directory.
+   The data starts out as zeros, inline in the inode if it fits,
+   otherwise as a hole; sectors are allocated only when written.
+   The free map is never inline: free_map_sync() writes it to disk
+   through its data sectors, without the in-memory inode.
+   Returns true if successful. */
+bool
+inode_create (block_sector_t sector, off_t length, bool is_dir)
+{
+  ASSERT (length >= 0);
+
+  /* If this assertion fails, the inode structure is not exactly
+     one sector in size, and you should fix that. */
+  ASSERT (sizeof (struct inode_disk) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct extent_block) == BLOCK_SECTOR_SIZE);
+
+  /* Build the inode in place in the cache. */
+  struct cache_entry *block = cache_get (sector, CACHE_INODE, sector,
+                                         CACHE_ZERO);
+  struct inode_disk *disk_inode = cache_data (block);
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  disk_inode->is_dir = is_dir;
+  disk_inode->is_inline = (length <= INODE_INLINE_MAX
+                           && sector != FREE_MAP_SECTOR);
+  cache_put (block, true);
+  return true;
+}
 
-      free(disk_inode);
+/* Copies INODE's in-memory inode_disk to the cache if it changed. */
+static void
+write_back (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+  if (inode->dirty)
+    {
+      cache_write_at (inode->sector, CACHE_INODE, inode->sector, 0,
+                      BLOCK_SECTOR_SIZE, &inode->data);
+      inode->dirty = false;
     }
+  lock_release (&inode->lock);
+}
 
+/* Copies every open inode that changed to the cache, so that a
+   following flush_cache() writes them to disk.  The inodes are
+   collected, and kept open, under the table lock, and written back
+   after it is released. */
+void
+inode_flush (void)
+{
+  struct list flush_list;
+  struct list_elem *e;
+  size_t i;
+
+  lock_acquire (&inode_flush_lock);
+  list_init (&flush_list);
+  lock_acquire (&open_inodes_lock);
+  for (i = 0; i < open_inode_buckets; i++)
+    for (e = list_begin (&open_inodes[i]); e != list_end (&open_inodes[i]);
+         e = list_next (e))
+      {
+        struct inode *inode = list_entry (e, struct inode, elem);
+        if (!inode->loading)
+          {
+            inode->open_cnt++;
+            list_push_back (&flush_list, &inode->flush_elem);
+          }
+      }
+  lock_release (&open_inodes_lock);
 
-  return success;
+  while (!list_empty (&flush_list))
+    {
+      struct inode *inode = list_entry (list_pop_front (&flush_list),
+                                        struct inode, flush_elem);
+      write_back (inode);
+      inode_close (inode);
+    }
+  lock_release (&inode_flush_lock);
 }
 
 /* Reads an inode from SECTOR
@@ -316,17 +764,22 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
+  struct list *chain;
   struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  lock_acquire (&open_inodes_lock);
+  chain = open_inode_chain (sector);
+  for (e = list_begin (chain); e != list_end (chain); e = list_next (e))
     {
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector)
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          while (inode->loading)
+            cond_wait (&inode_loaded, &open_inodes_lock);
+          lock_release (&open_inodes_lock);
           return inode;
         }
     }
@@ -334,14 +787,35 @@ inode_open (block_sector_t sector)
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is entered in the table as loading and
+     read with the lock released; concurrent openers find it and wait
+     for the read instead of starting one of their own. */
+  list_push_front (chain, &inode->elem);
+  if (++open_inode_cnt > OPEN_INODE_LOAD * open_inode_buckets)
+    grow_open_inodes ();
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->ra_last = -1;
+  inode->ra_next = 0;
+  inode->ra_window = 0;
+  lock_init (&inode->lock);
+  inode->dirty = false;
+  inode->loading = true;
+  lock_release (&open_inodes_lock);
+
+  cache_read_at (sector, CACHE_INODE, 0, BLOCK_SECTOR_SIZE, &inode->data);
+
+  lock_acquire (&open_inodes_lock);
+  inode->loading = false;
+  cond_broadcast (&inode_loaded, &open_inodes_lock);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -350,7 +824,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -371,81 +849,38 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* If this looks like the last opener, write back the inode if it
+     changed, before it leaves the table and a new opener could read
+     it from the cache.  The write happens with the table unlocked,
+     so somebody may reopen and change the inode meanwhile; repeat
+     until it is clean while we are still the only opener. */
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && !inode->removed && inode->dirty)
+    {
+      lock_release (&open_inodes_lock);
+      write_back (inode);
+      lock_acquire (&open_inodes_lock);
+    }
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
+      /* Remove from inode table and release lock. */
       list_remove (&inode->elem);
+      open_inode_cnt--;
+      lock_release (&open_inodes_lock);
 
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
-
-          struct inode_disk *disk_data = get_inode_disk(inode);
-
-          int sectors = bytes_to_sectors(disk_data->length);
-          if (sectors == 0) {
-            free_map_release (inode->sector, 1);
-          } else {
-
-              // Releasing direct blocks
-              for (int i = 0; i < NUM_DIRECT_POINTERS; i++) {
-                free_map_release(disk_data->direct_pointers[i], 1);
-                sectors--;
-                if (sectors == 0) {
-                  break;
-                }
-              }
-
-              struct indirect_disk* indirect_block; 
-              if (sectors > 0) {
-                // Releasing indirect data blocks
-                indirect_block = get_indirect_disk(disk_data->indirect_pointer);
-                for (int i = 0; i < NUM_POINTERS_PER_INDIRECT; i++) {
-                  free_map_release (indirect_block->pointers[i], 1);
-                  sectors--;
-                  if (sectors == 0) {
-                    break;
-                  }
-                }
-                
-                free_map_release (disk_data->indirect_pointer, 1);
-              }
-
-
-              struct indirect_disk* doubly_indirect_block; 
-              //Releasing doubly indirect pointers
-              if (sectors > 0) {
-                //Releasing indirect data blocks
-                doubly_indirect_block = get_indirect_disk(disk_data->doubly_indirect_pointer);
-                int j = 0;
-
-                while (sectors > 0) {
-
-                  indirect_block = get_indirect_disk(doubly_indirect_block->pointers[j]);
-
-                  for (int i = 0; i < NUM_POINTERS_PER_INDIRECT; i++) {
-                    free_map_release (indirect_block->pointers[i], 1);
-                    sectors--;
-                    if (sectors == 0) {
-                      break;
-                    }
-                  }
-
-                  free_map_release (disk_data->indirect_pointer, 1);
-                  j++;
-
-                }
-
-                free_map_release (disk_data->doubly_indirect_pointer, 1);
-
-              }
-              free_map_release (inode->sector, 1);
-            }
+          release_sectors (&inode->data);
+          free_map_release (inode->sector, 1);
         }
 
       free (inode);
     }
+  else
+    lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -457,6 +892,52 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* Called after a read of file sectors FIRST through LAST of INODE.
+   While reads keep continuing where the previous one ended, the
+   read-ahead window doubles up to READ_AHEAD_MAX and the sectors
+   beyond LAST are queued for the cache's read-ahead thread.  Any
+   other access pattern closes the window. */
+static void
+read_ahead (struct inode *inode, off_t first, off_t last)
+{
+  if (first == inode->ra_last || first == inode->ra_last + 1)
+    {
+      if (last > inode->ra_last)
+        {
+          inode->ra_window *= 2;
+          if (inode->ra_window < READ_AHEAD_MIN)
+            inode->ra_window = READ_AHEAD_MIN;
+          if (inode->ra_window > READ_AHEAD_MAX)
+            inode->ra_window = READ_AHEAD_MAX;
+        }
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_next = 0;
+    }
+  inode->ra_last = last;
+  if (inode->ra_window == 0)
+    return;
+
+  off_t next = inode->ra_next > last + 1 ? inode->ra_next : last + 1;
+  off_t end = last + 1 + inode->ra_window;
+  off_t length = inode_length (inode);
+  if (next < end && next * BLOCK_SECTOR_SIZE < length)
+    {
+      struct block_map map;
+      map_begin (&map, &inode->data, next);
+      for (; next < end && next * BLOCK_SECTOR_SIZE < length; next++)
+        {
+          block_sector_t sector = map_next (&map);
+          if (sector != 0)
+            cache_read_ahead (sector);
+        }
+      map_end (&map);
+    }
+  inode->ra_next = next;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -465,32 +946,39 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
-
-  char buff[BLOCK_SECTOR_SIZE];
-  read_from_cache(inode->sector, buff);
-  struct inode_disk *disk_data = buff;
-
-  if (disk_data->length < offset) {
-    return 0;
-  }
-
-  if (disk_data->length < size + offset) {
-    size = disk_data->length;
-  }
+  off_t length;
+  struct block_map map;
 
+  /* Inline data is copied under the lock, since a writer may move
+     it out of the inode. */
+  if (inode->data.is_inline)
+    {
+      lock_acquire (&inode->lock);
+      if (inode->data.is_inline)
+        {
+          length = inode->data.length;
+          if (offset < length)
+            {
+              bytes_read = size < length - offset ? size : length - offset;
+              memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+            }
+          lock_release (&inode->lock);
+          return bytes_read;
+        }
+      lock_release (&inode->lock);
+    }
 
-  while (size > 0)
+  length = inode_length (inode);
+  map_begin (&map, &inode->data, offset / BLOCK_SECTOR_SIZE);
+  while (size > 0 && offset < length)
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if (sector_idx == -1) {
-        break;
-      }
+      /* Disk sector to read, 0 in a hole, and starting byte offset
+         within sector. */
+      block_sector_t sector_idx = map_next (&map);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -499,31 +987,22 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          read_from_cache(sector_idx, buffer + bytes_read);
-        }
+      if (sector_idx != 0)
+        cache_read_at (sector_idx, data_class (inode), sector_ofs, chunk_size,
+                       buffer + bytes_read);
       else
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          read_from_cache(sector_idx, bounce);
-          memcpy(buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+        memset (buffer + bytes_read, 0, chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  map_end (&map);
+
+  if (bytes_read > 0)
+    read_ahead (inode, (offset - bytes_read) / BLOCK_SECTOR_SIZE,
+                (offset - 1) / BLOCK_SECTOR_SIZE);
 
   return bytes_read;
 }
@@ -539,195 +1018,67 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
-  off_t OGoffset = offset;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
-  if (inode->deny_write_cnt) {
+  if (inode->deny_write_cnt)
     return 0;
-  }
-
-  char buff[BLOCK_SECTOR_SIZE];
-  read_from_cache(inode->sector, buff);
-  struct inode_disk *disk_data = buff;
 
-  int file_length = disk_data->length;
-  int allocated_sectors = bytes_to_sectors(file_length);
-  int needed_sectors = bytes_to_sectors(size + offset) - allocated_sectors;
-
-  static char zeros[BLOCK_SECTOR_SIZE];
-  memset(zeros, 0, BLOCK_SECTOR_SIZE);
-
-
-  if (size + offset > file_length) {
-    // expand
-
-    int num = needed_sectors;
-    if (allocated_sectors <= NUM_DIRECT_POINTERS) {
-      if (num > NUM_DIRECT_POINTERS - allocated_sectors) {
-        num = NUM_DIRECT_POINTERS - allocated_sectors;
-      }
-      // allocate needed direct pointers
-      for (int i = allocated_sectors; i < allocated_sectors + num; i++) {
-        if (!free_map_allocate (1, &disk_data->direct_pointers[i])) {
-          return 0;
-        }
-        char zeros[BLOCK_SECTOR_SIZE];
-        memset(zeros, 0, BLOCK_SECTOR_SIZE);
-        write_to_cache(disk_data->direct_pointers[i], zeros);
-        needed_sectors--;
-      }
-    }
-
-    if (needed_sectors > 0 && allocated_sectors <= (NUM_DIRECT_POINTERS + NUM_POINTERS_PER_INDIRECT)) {
-      int current_pos = allocated_sectors - NUM_DIRECT_POINTERS;
-      if (current_pos < 0) {
-        current_pos = 0;
-      }
-
-      struct indirect_disk *indirect_block;
-      if (current_pos == 0) {
-        indirect_block = malloc(sizeof(struct indirect_disk));
-        // memset(indirect_block->pointers, 0, BLOCK_SECTOR_SIZE);
-        if (!free_map_allocate (1, &disk_data->indirect_pointer)) {
-          return 0;
-        }
-      } else {
-        indirect_block = get_indirect_disk(disk_data->indirect_pointer);
-      }
-
-      num = needed_sectors;
-      if (num > NUM_POINTERS_PER_INDIRECT - current_pos) {
-        num = NUM_POINTERS_PER_INDIRECT - current_pos;
-      }
-
-      // block_sector_t old_pointers[current_pos];
-      block_sector_t *old_pointers = malloc(current_pos * sizeof(block_sector_t));
-      for (int i = 0; i < current_pos; i++) {
-        old_pointers[i] = indirect_block->pointers[i];
-      }
-
-      // block_sector_t new_pointers[num];
-      block_sector_t *new_pointers = malloc(num * sizeof(block_sector_t));
-      for (int i = current_pos; i < current_pos + num; i++) {
-        if (!free_map_allocate (1, &new_pointers[i - current_pos])) {
-          return 0;
+  /* Write inline data in place, or move it out to a data sector if
+     the file grows too large for it. */
+  if (inode->data.is_inline)
+    {
+      lock_acquire (&inode->lock);
+      if (inode->data.is_inline)
+        {
+          if (offset + size <= INODE_INLINE_MAX)
+            {
+              memcpy (inode->data.inline_data + offset, buffer, size);
+              if (offset + size > inode->data.length)
+                inode->data.length = offset + size;
+              inode->dirty = true;
+              lock_release (&inode->lock);
+              return size;
+            }
+          if (!migrate_inline (inode))
+            {
+              lock_release (&inode->lock);
+              return 0;
+            }
         }
-        char zeros[BLOCK_SECTOR_SIZE];
-        memset(zeros, 0, BLOCK_SECTOR_SIZE);
-        write_to_cache(new_pointers[i - current_pos], zeros);
-        needed_sectors--;
-      }
-
-      for (int i = 0; i < current_pos; i++) {
-        indirect_block->pointers[i] = old_pointers[i];
-      }
-
-      for (int i = current_pos; i < current_pos + num; i++) {
-        indirect_block->pointers[i] = new_pointers[i - current_pos];
-      }
-
-      write_to_cache(disk_data->indirect_pointer, indirect_block);
-      free(old_pointers);
-      free(new_pointers);
+      lock_release (&inode->lock);
     }
 
-    // doubly indirect pointers
-    if (needed_sectors > 0) {
-
-      int current_pos = allocated_sectors - (NUM_DIRECT_POINTERS + NUM_POINTERS_PER_INDIRECT);
-      if (current_pos < 0) {
-        current_pos = 0;
-      }
-
-      struct indirect_disk *doubly_indirect_block;
-      if (current_pos == 0) {
-        // need to allocated the doubly indirect block
-        doubly_indirect_block = malloc(sizeof(struct indirect_disk));
-        if (!free_map_allocate (1, &disk_data->doubly_indirect_pointer)) {
-          return 0;
-        }
-      } else {
-        // doubly indirect already exists
-        doubly_indirect_block = get_indirect_disk(disk_data->doubly_indirect_pointer);
-      }
-
-      // int used_indirect_blocks = DIV_ROUND_UP(current_pos, NUM_POINTERS_PER_INDIRECT);
-      int used_indirect_blocks = current_pos / NUM_POINTERS_PER_INDIRECT;
-      int indirect_offset = current_pos % NUM_POINTERS_PER_INDIRECT;
-
-      struct indirect_disk *indirect_block;
-      if (indirect_offset != 0) {
-      
-        indirect_block = get_indirect_disk(doubly_indirect_block->pointers[used_indirect_blocks]);
-
-        num = needed_sectors;
-        if (num > NUM_POINTERS_PER_INDIRECT - indirect_offset) {
-          num = NUM_POINTERS_PER_INDIRECT - indirect_offset;
-        }
-
-        for (int i = indirect_offset; i < indirect_offset + num; i++) {
-          if (!free_map_allocate (1, &indirect_block->pointers[i])) {
-            return 0;
-          }
-          char zeros[BLOCK_SECTOR_SIZE];
-          memset(zeros, 0, BLOCK_SECTOR_SIZE);
-          write_to_cache(indirect_block->pointers[i], zeros);
-          needed_sectors--;
-        }
-
-        write_to_cache(doubly_indirect_block->pointers[used_indirect_blocks], indirect_block);
-        used_indirect_blocks++;
-      }
-
-
-      while (needed_sectors > 0) {
-        indirect_block = malloc(sizeof(struct indirect_disk));
-        if (!free_map_allocate (1, &doubly_indirect_block->pointers[used_indirect_blocks])) {
-          return 0;
-        }
-
-
-        num = needed_sectors;
-        if (num > NUM_POINTERS_PER_INDIRECT) {
-          num = NUM_POINTERS_PER_INDIRECT;
-        }
-
-        for (int i = 0; i < num; i++) {
-          if (!free_map_allocate (1, &indirect_block->pointers[i])) {
-            return 0;
-          }
-          char zeros[BLOCK_SECTOR_SIZE];
-          memset(zeros, 0, BLOCK_SECTOR_SIZE);
-          write_to_cache(indirect_block->pointers[i], zeros);
-          needed_sectors--;
-        }
-
-
-        write_to_cache(doubly_indirect_block->pointers[used_indirect_blocks], indirect_block);
-        used_indirect_blocks++;
-
-        free(indirect_block);
-      }
-
-      write_to_cache(disk_data->doubly_indirect_pointer, doubly_indirect_block);
+  size_t first = offset / BLOCK_SECTOR_SIZE;
+  size_t end = bytes_to_sectors (offset + size);
+  if (offset + size > inode_length (inode)
+      || !range_mapped (&inode->data, first, end))
+    {
+      /* Allocate the sectors written that lie in holes, leaving any
+         skipped over as holes. */
+      bool success;
+      lock_acquire (&inode->lock);
+      success = allocate_sectors (&inode->data, inode->sector, offset, size);
+      inode->dirty = true;
+      lock_release (&inode->lock);
+      if (!success)
+        return 0;
     }
+  off_t length = inode_length (inode);
+  if (offset + size > length)
+    length = offset + size;
+  struct block_map map;
 
-    disk_data->length = offset + size;
-    write_to_cache(inode->sector, disk_data);
-  }
-
-  while (size > 0) {
+  map_begin (&map, &inode->data, offset / BLOCK_SECTOR_SIZE);
+  while (size > 0 && offset < length)
+    {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      if (sector_idx == -1) {
+      block_sector_t sector_idx = map_next (&map);
+      if (sector_idx == 0)
         break;
-      }
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      // off_t inode_left = disk_data->length - offset;
+      off_t inode_left = length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -736,38 +1087,29 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE) {
-          /* Write full sector directly to disk. */
-        write_to_cache(sector_idx, buffer + bytes_written);
-      } else {
-        /* We need a bounce buffer. */
-        if (bounce == NULL)
-          {
-            bounce = malloc (BLOCK_SECTOR_SIZE);
-            if (bounce == NULL)
-              break;
-          }
-
-        /* If the sector contains data before or after the chunk
-           we're writing, then we need to read in the sector
-           first.  Otherwise we start with a sector of all zeros. */
-        if (sector_ofs > 0 || chunk_size < sector_left)
-          // block_read (fs_device, sector_idx, bounce);
-          read_from_cache(sector_idx, bounce);
-        else
-          memset (bounce, 0, BLOCK_SECTOR_SIZE);
-        memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-        write_to_cache(sector_idx, bounce);
-      }
-
+      cache_write_at (sector_idx, data_class (inode), inode->sector,
+                      sector_ofs, chunk_size, buffer + bytes_written);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+    }
+  map_end (&map);
 
+  /* Extend the file only now that the data is in place, since new
+     sectors the write covers were not zeroed: readers must never see
+     their old contents. */
+  if (offset > inode_length (inode))
+    {
+      lock_acquire (&inode->lock);
+      if (offset > inode->data.length)
+        {
+          inode->data.length = offset;
+          inode->dirty = true;
+        }
+      lock_release (&inode->lock);
     }
-  free (bounce);
 
   return bytes_written;
 }
@@ -792,11 +1134,21 @@ inode_allow_write (struct inode *inode)
   inode->deny_write_cnt--;
 }
 
+/* Writes INODE's dirty blocks to disk, along with the free map so
+   that the blocks allocated to it are recorded too. */
+void
+inode_sync (struct inode *inode)
+{
+  free_map_flush ();
+  write_back (inode);
+  cache_sync (inode->sector);
+  if (inode->sector != FREE_MAP_SECTOR)
+    cache_sync (FREE_MAP_SECTOR);
+}
+
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  // return inode->data.length;
-  struct inode_disk *disk_inode = get_inode_disk(inode);
-  return disk_inode->length;
+  return inode->data.length;
 }
\ No newline at end of file
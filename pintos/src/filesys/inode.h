@@ -11,7 +11,7 @@ struct inode;
 // struct indirect_disk;
 
 void inode_init (void);
-bool inode_create (block_sector_t, off_t);
+bool inode_create (block_sector_t, off_t, bool is_dir);
 struct inode *inode_open (block_sector_t);
 struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
@@ -22,11 +22,12 @@ off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_sync (struct inode *);
+void inode_flush (void);
 
-bool inode_is_dir(struct inode_disk *);
+bool inode_is_dir (struct inode *);
+bool inode_is_indexed (struct inode *);
+void inode_set_indexed (struct inode *);
 int inode_get_open_cnt(struct inode *inode);
-struct inode_disk *get_inode_disk(struct inode *);
-struct indirect_disk *get_indirect_disk(block_sector_t);
-void set_is_dir(struct inode_disk *disk_data, bool value);
 
 #endif /* filesys/inode.h */
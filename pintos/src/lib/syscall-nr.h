@@ -31,7 +31,11 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FSYNC,                  /* Writes a file's dirty blocks to disk. */
+    SYS_GETDENTS,               /* Reads many directory entries. */
+    SYS_STAT,                   /* Gets a named file's size, type and inode. */
+    SYS_FSTAT                   /* Gets an open file's size, type and inode. */
   };
 
 #endif /* lib/syscall-nr.h */
@@ -191,6 +191,30 @@ inumber (int fd)
   return syscall1 (SYS_INUMBER, fd);
 }
 
+bool
+fsync (int fd)
+{
+  return syscall1 (SYS_FSYNC, fd);
+}
+
+int
+getdents (int fd, struct dirent *entries, int cnt)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, cnt);
+}
+
+bool
+stat (const char *file, struct stat *st)
+{
+  return syscall2 (SYS_STAT, file, st);
+}
+
+bool
+fstat (int fd, struct stat *st)
+{
+  return syscall2 (SYS_FSTAT, fd, st);
+}
+
 void*
 sbrk (intptr_t increment)
 {
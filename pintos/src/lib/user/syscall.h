@@ -16,6 +16,22 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* A directory entry, as returned by getdents(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Directory or file? */
+    char name[READDIR_MAX_LEN + 1];     /* Null-terminated name. */
+  };
+
+/* A file's attributes, as returned by stat() and fstat(). */
+struct stat
+  {
+    int size;                           /* Length in bytes. */
+    bool is_dir;                        /* Directory or file? */
+    int inumber;                        /* Inode number. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -46,6 +62,15 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool fsync (int fd);
+int getdents (int fd, struct dirent *, int cnt);
+bool stat (const char *file, struct stat *);
+bool fstat (int fd, struct stat *);
+
+/* Buffer cache statistics: 0 resets the cache, 1 hits, 2 accesses,
+   3 device reads, 4 device writes, 5 read-ahead blocks loaded,
+   6 read-ahead blocks used. */
+int get_cache (int index);
 
 /* Homework 5, Part B. */
 void* sbrk (intptr_t increment);
@@ -0,0 +1,48 @@
+/* Reads a file sequentially from a cold cache and checks that
+   blocks loaded by the read-ahead thread were used by the reader. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "filesys/cache.h"
+
+#define NUM_SECTORS 64
+static char tempBuf[BLOCK_SECTOR_SIZE];
+
+void
+test_main (void)
+{
+  int file;
+  int index;
+
+  CHECK (create ("xyz", 0), "create \"xyz\"");
+  CHECK ((file = open ("xyz")) > 1, "open \"xyz\" for writing");
+  random_init (0);
+  for (index = 0; index < NUM_SECTORS; index++) {
+    random_bytes (tempBuf, sizeof tempBuf);
+    if (write (file, tempBuf, BLOCK_SECTOR_SIZE) != BLOCK_SECTOR_SIZE)
+      fail ("didn't write proper number of bytes");
+  }
+  msg ("close \"xyz\" after writing");
+  close (file);
+
+  msg ("cache reset");
+  get_cache (0);
+
+  CHECK ((file = open ("xyz")) > 1, "open \"xyz\" for sequential read");
+  for (index = 0; index < NUM_SECTORS; index++) {
+    if (read (file, tempBuf, BLOCK_SECTOR_SIZE) != BLOCK_SECTOR_SIZE)
+      fail ("didn't read proper number of bytes");
+  }
+  msg ("close \"xyz\" after reading");
+  close (file);
+
+  /* get_cache(5) counts prefetched blocks, get_cache(6) those used. */
+  int prefetched = get_cache (5);
+  int used = get_cache (6);
+  if (prefetched > 0 && used > 0 && used <= prefetched)
+    msg ("sequential read used read-ahead blocks");
+
+  CHECK (remove ("xyz"), "remove \"xyz\"");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(CacheTest3) begin
+(CacheTest3) create "xyz"
+(CacheTest3) open "xyz" for writing
+(CacheTest3) close "xyz" after writing
+(CacheTest3) cache reset
+(CacheTest3) open "xyz" for sequential read
+(CacheTest3) close "xyz" after reading
+(CacheTest3) sequential read used read-ahead blocks
+(CacheTest3) remove "xyz"
+(CacheTest3) end
+CacheTest3: exit(0)
+EOF
+pass;
\ No newline at end of file
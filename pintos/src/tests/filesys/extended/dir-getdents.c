@@ -0,0 +1,69 @@
+/* Lists a directory of 40 files and one subdirectory with a single
+   getdents() call and checks the names, inumbers and types. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 40
+
+static struct dirent entries[FILE_CNT + 8];
+
+void
+test_main (void)
+{
+  char path[32];
+  int fd, cnt, i, files = 0, dirs = 0;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (mkdir ("d/sub"), "mkdir \"d/sub\"");
+  msg ("create %d files in \"d\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (path, sizeof path, "d/f%d", i);
+      if (!create (path, 0))
+        fail ("create \"%s\" failed", path);
+    }
+
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  cnt = getdents (fd, entries, FILE_CNT + 8);
+  if (cnt != FILE_CNT + 1)
+    fail ("getdents returned %d entries, expected %d", cnt, FILE_CNT + 1);
+  for (i = 0; i < cnt; i++)
+    {
+      int entry_fd;
+
+      snprintf (path, sizeof path, "d/%s", entries[i].name);
+      if ((entry_fd = open (path)) < 2)
+        fail ("open \"%s\" failed", path);
+      if (inumber (entry_fd) != entries[i].inumber)
+        fail ("\"%s\" has inumber %d, getdents said %d",
+              path, inumber (entry_fd), entries[i].inumber);
+      if (isdir (entry_fd) != entries[i].is_dir)
+        fail ("getdents got the type of \"%s\" wrong", path);
+      close (entry_fd);
+      if (entries[i].is_dir)
+        dirs++;
+      else
+        files++;
+    }
+  if (files != FILE_CNT || dirs != 1)
+    fail ("getdents found %d files and %d directories", files, dirs);
+  msg ("getdents listed every entry");
+
+  CHECK (getdents (fd, entries, FILE_CNT + 8) == 0, "getdents at end");
+  msg ("close \"d\"");
+  close (fd);
+
+  msg ("remove \"d\" and its contents");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (path, sizeof path, "d/f%d", i);
+      if (!remove (path))
+        fail ("remove \"%s\" failed", path);
+    }
+  CHECK (remove ("d/sub"), "remove \"d/sub\"");
+  CHECK (remove ("d"), "remove \"d\"");
+}
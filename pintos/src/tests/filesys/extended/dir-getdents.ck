@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "d"
+(dir-getdents) mkdir "d/sub"
+(dir-getdents) create 40 files in "d"
+(dir-getdents) open "d"
+(dir-getdents) getdents listed every entry
+(dir-getdents) getdents at end
+(dir-getdents) close "d"
+(dir-getdents) remove "d" and its contents
+(dir-getdents) remove "d/sub"
+(dir-getdents) remove "d"
+(dir-getdents) end
+dir-getdents: exit(0)
+EOF
+pass;
@@ -0,0 +1,66 @@
+/* Fills a directory past the size at which it switches to the
+   hashed format, then checks that lookups, removals and readdir
+   all still see exactly the right entries. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 150
+
+void
+test_main (void)
+{
+  char name[READDIR_MAX_LEN + 1];
+  char path[32];
+  size_t i;
+  int fd, cnt;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+
+  msg ("create %d files in \"big\"", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (path, sizeof path, "big/f%zu", i);
+      if (!create (path, 0))
+        fail ("create \"%s\" failed", path);
+    }
+
+  msg ("open each file");
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (path, sizeof path, "big/f%zu", i);
+      if ((fd = open (path)) < 2)
+        fail ("open \"%s\" failed", path);
+      close (fd);
+    }
+
+  msg ("remove every other file");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      snprintf (path, sizeof path, "big/f%zu", i);
+      if (!remove (path))
+        fail ("remove \"%s\" failed", path);
+      if (open (path) != -1)
+        fail ("\"%s\" can still be opened after removal", path);
+    }
+
+  CHECK ((fd = open ("big")) > 1, "open \"big\"");
+  cnt = 0;
+  while (readdir (fd, name))
+    cnt++;
+  if (cnt != FILE_CNT / 2)
+    fail ("readdir found %d entries, expected %d", cnt, FILE_CNT / 2);
+  msg ("readdir found %d entries", cnt);
+  close (fd);
+
+  msg ("remove the rest");
+  for (i = 1; i < FILE_CNT; i += 2)
+    {
+      snprintf (path, sizeof path, "big/f%zu", i);
+      if (!remove (path))
+        fail ("remove \"%s\" failed", path);
+    }
+  CHECK (remove ("big"), "remove \"big\"");
+}
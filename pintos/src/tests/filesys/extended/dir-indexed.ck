@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(dir-indexed) begin
+(dir-indexed) mkdir "big"
+(dir-indexed) create 150 files in "big"
+(dir-indexed) open each file
+(dir-indexed) remove every other file
+(dir-indexed) open "big"
+(dir-indexed) readdir found 75 entries
+(dir-indexed) remove the rest
+(dir-indexed) remove "big"
+(dir-indexed) end
+dir-indexed: exit(0)
+EOF
+pass;
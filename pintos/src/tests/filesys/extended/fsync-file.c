@@ -0,0 +1,63 @@
+/* Dirties two files and checks that fsync() on one of them writes
+   that file's blocks to disk but leaves the other file's alone. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "filesys/cache.h"
+
+#define LOG_SECTORS 4
+#define OTHER_SECTORS 16
+static char buf[BLOCK_SECTOR_SIZE];
+
+static void
+write_sectors (int fd, int cnt)
+{
+  int i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      random_bytes (buf, sizeof buf);
+      if (write (fd, buf, sizeof buf) != (int) sizeof buf)
+        fail ("didn't write proper number of bytes");
+    }
+}
+
+void
+test_main (void)
+{
+  int log, other;
+
+  CHECK (create ("log", 0), "create \"log\"");
+  CHECK (create ("other", 0), "create \"other\"");
+  CHECK ((log = open ("log")) > 1, "open \"log\"");
+  CHECK ((other = open ("other")) > 1, "open \"other\"");
+
+  msg ("cache reset");
+  get_cache (0);
+
+  random_init (0);
+  write_sectors (other, OTHER_SECTORS);
+  write_sectors (log, LOG_SECTORS);
+
+  /* get_cache(4) counts device writes. */
+  int before = get_cache (4);
+  CHECK (fsync (log), "fsync \"log\"");
+  int written = get_cache (4) - before;
+  if (written < LOG_SECTORS)
+    fail ("fsync wrote %d sectors, expected at least %d",
+          written, LOG_SECTORS);
+  if (written >= OTHER_SECTORS)
+    fail ("fsync wrote %d sectors, including another file's", written);
+  msg ("fsync wrote only \"log\"");
+
+  CHECK (!fsync (12345), "fsync bad fd");
+
+  msg ("close \"log\"");
+  close (log);
+  msg ("close \"other\"");
+  close (other);
+  CHECK (remove ("log"), "remove \"log\"");
+  CHECK (remove ("other"), "remove \"other\"");
+}
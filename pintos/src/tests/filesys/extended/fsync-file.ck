@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(fsync-file) begin
+(fsync-file) create "log"
+(fsync-file) create "other"
+(fsync-file) open "log"
+(fsync-file) open "other"
+(fsync-file) cache reset
+(fsync-file) fsync "log"
+(fsync-file) fsync wrote only "log"
+(fsync-file) fsync bad fd
+(fsync-file) close "log"
+(fsync-file) close "other"
+(fsync-file) remove "log"
+(fsync-file) remove "other"
+(fsync-file) end
+fsync-file: exit(0)
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Checks that reading a tiny file needs no cache access beyond its
+   inode, and that the file keeps its contents when it grows too
+   large to stay inline. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define TINY 10
+#define LARGE 600
+static char buf[LARGE];
+static char expected[LARGE];
+
+void
+test_main (void)
+{
+  int fd;
+
+  memcpy (expected, "tiny file.", TINY);
+  CHECK (create ("tiny", 0), "create \"tiny\"");
+  CHECK ((fd = open ("tiny")) > 1, "open \"tiny\"");
+  CHECK (write (fd, expected, TINY) == TINY, "write \"tiny\"");
+  msg ("close \"tiny\"");
+  close (fd);
+
+  msg ("cache reset");
+  get_cache (0);
+  CHECK ((fd = open ("tiny")) > 1, "open \"tiny\"");
+
+  /* get_cache(2) counts cache accesses. */
+  int before = get_cache (2);
+  CHECK (read (fd, buf, TINY) == TINY, "read \"tiny\"");
+  int accesses = get_cache (2) - before;
+  if (accesses != 0)
+    fail ("read of a %d-byte file made %d cache accesses", TINY, accesses);
+  if (memcmp (buf, expected, TINY))
+    fail ("\"tiny\" read back wrong contents");
+  msg ("read \"tiny\" from its inode");
+
+  memset (expected + TINY, 'x', LARGE - TINY);
+  CHECK (write (fd, expected + TINY, LARGE - TINY) == LARGE - TINY,
+         "grow \"tiny\" to %d bytes", LARGE);
+  seek (fd, 0);
+  CHECK (read (fd, buf, LARGE) == LARGE, "read \"tiny\"");
+  if (memcmp (buf, expected, LARGE))
+    fail ("\"tiny\" read back wrong contents after growing");
+  msg ("contents kept after growing");
+
+  msg ("close \"tiny\"");
+  close (fd);
+  CHECK (remove ("tiny"), "remove \"tiny\"");
+}
@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(inline-file) begin
+(inline-file) create "tiny"
+(inline-file) open "tiny"
+(inline-file) write "tiny"
+(inline-file) close "tiny"
+(inline-file) cache reset
+(inline-file) open "tiny"
+(inline-file) read "tiny"
+(inline-file) read "tiny" from its inode
+(inline-file) grow "tiny" to 600 bytes
+(inline-file) read "tiny"
+(inline-file) contents kept after growing
+(inline-file) close "tiny"
+(inline-file) remove "tiny"
+(inline-file) end
+inline-file: exit(0)
+EOF
+pass;
@@ -0,0 +1,51 @@
+/* Writes one byte 1 MB into an empty file and checks that the
+   skipped part reads back as zeros and was never written to
+   disk. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "filesys/cache.h"
+
+#define SKIP (1024 * 1024)
+#define MAX_WRITES 16
+static char buf[BLOCK_SECTOR_SIZE];
+
+void
+test_main (void)
+{
+  int fd;
+  size_t i;
+
+  CHECK (create ("sparse", 0), "create \"sparse\"");
+  CHECK ((fd = open ("sparse")) > 1, "open \"sparse\"");
+
+  msg ("cache reset");
+  get_cache (0);
+
+  msg ("seek \"sparse\" to %d", SKIP);
+  seek (fd, SKIP);
+  CHECK (write (fd, "x", 1) == 1, "write \"sparse\"");
+  CHECK (fsync (fd), "fsync \"sparse\"");
+
+  /* get_cache(4) counts device writes. */
+  int written = get_cache (4);
+  if (written > MAX_WRITES)
+    fail ("wrote %d sectors for a one-byte write, expected at most %d",
+          written, MAX_WRITES);
+  msg ("skipped sectors were not written");
+
+  CHECK (filesize (fd) == SKIP + 1, "filesize \"sparse\"");
+
+  seek (fd, SKIP / 2);
+  CHECK (read (fd, buf, sizeof buf) == (int) sizeof buf, "read \"sparse\"");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 0)
+      fail ("byte %zu of hole is %d, not zero", SKIP / 2 + i, buf[i]);
+  msg ("hole reads as zeros");
+
+  msg ("close \"sparse\"");
+  close (fd);
+  CHECK (remove ("sparse"), "remove \"sparse\"");
+}
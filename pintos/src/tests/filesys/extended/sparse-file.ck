@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(sparse-file) begin
+(sparse-file) create "sparse"
+(sparse-file) open "sparse"
+(sparse-file) cache reset
+(sparse-file) seek "sparse" to 1048576
+(sparse-file) write "sparse"
+(sparse-file) fsync "sparse"
+(sparse-file) skipped sectors were not written
+(sparse-file) filesize "sparse"
+(sparse-file) read "sparse"
+(sparse-file) hole reads as zeros
+(sparse-file) close "sparse"
+(sparse-file) remove "sparse"
+(sparse-file) end
+sparse-file: exit(0)
+EOF
+pass;
@@ -0,0 +1,72 @@
+/* Checks that stat() and fstat() report the size, type and inumber
+   that open(), filesize(), isdir() and inumber() do. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[1234];
+
+static void
+check_stat (const char *name, int size, bool is_dir)
+{
+  struct stat by_name, by_fd;
+  int fd;
+
+  if (!stat (name, &by_name))
+    fail ("stat \"%s\" failed", name);
+  if ((fd = open (name)) < 2)
+    fail ("open \"%s\" failed", name);
+  if (!fstat (fd, &by_fd))
+    fail ("fstat \"%s\" failed", name);
+  if (by_name.size != size || by_fd.size != size)
+    fail ("\"%s\" has size %d (stat) and %d (fstat), expected %d",
+          name, by_name.size, by_fd.size, size);
+  if (by_name.is_dir != is_dir || by_fd.is_dir != is_dir)
+    fail ("stat got the type of \"%s\" wrong", name);
+  if (by_name.inumber != inumber (fd) || by_fd.inumber != inumber (fd))
+    fail ("\"%s\" has inumber %d, stat said %d and fstat %d",
+          name, inumber (fd), by_name.inumber, by_fd.inumber);
+  close (fd);
+  msg ("stat \"%s\"", name);
+}
+
+void
+test_main (void)
+{
+  struct stat st;
+  int fd;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (create ("d/f", 0), "create \"d/f\"");
+  CHECK ((fd = open ("d/f")) > 1, "open \"d/f\"");
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write %zu bytes to \"d/f\"", sizeof buf);
+  msg ("close \"d/f\"");
+  close (fd);
+
+  check_stat ("d/f", sizeof buf, false);
+  if (!stat ("d", &st) || !st.is_dir)
+    fail ("stat \"d\" failed");
+  msg ("stat \"d\"");
+  if (!stat ("d/", &st) || !st.is_dir)
+    fail ("stat \"d/\" failed");
+  msg ("stat \"d/\"");
+  if (!stat ("/d/", &st) || !st.is_dir)
+    fail ("stat \"/d/\" failed");
+  msg ("stat \"/d/\"");
+  if (!stat ("d/.", &st) || !st.is_dir)
+    fail ("stat \"d/.\" failed");
+  msg ("stat \"d/.\"");
+  if (!stat (".", &st) || !st.is_dir)
+    fail ("stat \".\" failed");
+  msg ("stat \".\"");
+  if (!stat ("/", &st) || !st.is_dir)
+    fail ("stat \"/\" failed");
+  msg ("stat \"/\"");
+  CHECK (!stat ("d/missing", &st), "stat \"d/missing\" (must fail)");
+  CHECK (!fstat (42, &st), "fstat bad fd (must fail)");
+
+  CHECK (remove ("d/f"), "remove \"d/f\"");
+  CHECK (remove ("d"), "remove \"d\"");
+}
@@ -0,0 +1,26 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_USER_FAULTS => 1, [<<'EOF']);
+(stat-file) begin
+(stat-file) mkdir "d"
+(stat-file) create "d/f"
+(stat-file) open "d/f"
+(stat-file) write 1234 bytes to "d/f"
+(stat-file) close "d/f"
+(stat-file) stat "d/f"
+(stat-file) stat "d"
+(stat-file) stat "d/"
+(stat-file) stat "/d/"
+(stat-file) stat "d/."
+(stat-file) stat "."
+(stat-file) stat "/"
+(stat-file) stat "d/missing" (must fail)
+(stat-file) fstat bad fd (must fail)
+(stat-file) remove "d/f"
+(stat-file) remove "d"
+(stat-file) end
+stat-file: exit(0)
+EOF
+pass;
@@ -53,6 +53,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -cache: Number of sectors held by the buffer cache. */
+static size_t cache_entry_cnt = NUM_CACHE_ENTRIES;
 #endif /* FILESYS */
 
 /* -ul: Maximum number of pages to put into palloc's user pool. */
@@ -123,7 +126,7 @@ main (void)
 
 #ifdef FILESYS
   /* Initialize file system. */
-  initialize_cache ();
+  initialize_cache (cache_entry_cnt);
   ide_init ();
   locate_block_devices ();
   filesys_init (format_filesys);
@@ -249,6 +252,24 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value == NULL || atoi (value) < CACHE_MIN_ENTRIES)
+            PANIC ("-cache requires at least %d sectors", CACHE_MIN_ENTRIES);
+          cache_entry_cnt = atoi (value);
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !cache_select_policy (value))
+            PANIC ("unknown cache policy `%s' (use lru, clock or 2q)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-cache-age"))
+        cache_dirty_age_ms = atoi (value);
+      else if (!strcmp (name, "-cache-dirty"))
+        cache_dirty_ratio = atoi (value);
+      else if (!strcmp (name, "-cache-meta"))
+        cache_meta_pct = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -317,6 +338,7 @@ run_actions (char **argv)
       {"rm", 2, fsutil_rm},
       {"extract", 1, fsutil_extract},
       {"append", 2, fsutil_append},
+      {"cachebench", 1, fsutil_cachebench},
 #endif
       {NULL, 0, NULL},
     };
@@ -363,6 +385,7 @@ usage (void)
           "  ls                 List files in the root directory.\n"
           "  cat FILE           Print FILE to the console.\n"
           "  rm FILE            Delete FILE.\n"
+          "  cachebench         Time buffer cache lookups.\n"
           "Use these actions indirectly via `pintos' -g and -p options:\n"
           "  extract            Untar from scratch device into file system.\n"
           "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -375,6 +398,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=N           Cache N file system sectors (default 64).\n"
+          "  -cache-policy=P    Replace cache blocks by P: lru, clock or 2q.\n"
+          "  -cache-age=MS      Write back blocks dirty for MS ms (default 5000).\n"
+          "  -cache-dirty=PCT   Write back early above PCT%% dirty (default 50).\n"
+          "  -cache-meta=PCT    Keep PCT%% of the cache for metadata (default 25).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -5,6 +5,7 @@
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "threads/malloc.h"
 #include "devices/shutdown.h"
 #include "threads/vaddr.h"
 #include "filesys/file.h"
@@ -28,8 +29,14 @@ static bool remove_helper(const char *file_name);
 static int write_helper (int fd, const void *buffer, unsigned size);
 static int filesize_helper (int fd);
 static int open_helper (const char *file);
+static bool fsync_helper (int fd);
+static int getdents_helper (int fd, struct dirent *entries, int cnt);
+static bool stat_helper (char *file, struct stat *st);
+static bool fstat_helper (int fd, struct stat *st);
+static void fill_stat (struct inode *inode, struct stat *st);
 
 static bool validate_arg (void *arg);
+static bool validate_buffer (void *buffer, size_t size);
 
 
 // global lock for file system level
@@ -66,7 +73,7 @@ int open_helper (const char *file) {
     return -1;
   }
 
-  if (inode_is_dir(get_inode_disk(get_last_inode(metadata)))) {
+  if (inode_is_dir(get_last_inode(metadata))) {
     dir = dir_open(get_last_inode(metadata));
     
     dir_close(get_parent_dir(metadata));
@@ -81,6 +88,7 @@ int open_helper (const char *file) {
     return fd;
   }
 
+  inode_close(get_last_inode(metadata));
 	struct file *opened_file = filesys_open_file(get_last_filename(metadata), get_parent_dir(metadata));
 	if (opened_file) {	
 		int fd = (current_thread->current_fd)++;
@@ -140,9 +148,12 @@ bool remove_helper (const char *file_name) {
   }
 
   struct inode *last_inode = get_last_inode(metadata);
-  if (inode_is_dir(get_inode_disk(last_inode))) {
+  if (inode_is_dir(last_inode)) {
 
     if (strcmp(get_last_filename(metadata), "/") == 0) {
+      inode_close(last_inode);
+      dir_close(get_parent_dir(metadata));
+      free(metadata);
       return false;
     }
 
@@ -160,14 +171,22 @@ bool remove_helper (const char *file_name) {
           thread_set_directory(current_thread, NULL);
         }
       }
+      dir_close(current_dir);
+      dir_close(get_parent_dir(metadata));
+      free(metadata);
       return success1 && success2 && success3;
     } else {
+      dir_close(current_dir);
+      dir_close(get_parent_dir(metadata));
+      free(metadata);
       return false;
     }
 
   } else {
+    inode_close(last_inode);
     bool success = filesys_remove_anyPath(get_last_filename(metadata), get_parent_dir(metadata));
     dir_close(get_parent_dir(metadata));
+    free(metadata);
     return success;
   }
 	// lock_release(&flock);
@@ -251,17 +270,18 @@ bool chdir_helper (char* dirName) {
 
   struct inode *last_inode = get_last_inode(metadata);
 
-  struct inode_disk *disk_data = get_inode_disk(last_inode);
-  if (disk_data != NULL) {
-    if (!inode_is_dir(disk_data)) {
-      return false;
-    }
+  if (!inode_is_dir(last_inode)) {
+    inode_close(last_inode);
+    dir_close(get_parent_dir(metadata));
+    free(metadata);
+    return false;
   }
   
 
   dir_close(current_thread->current_directory);
   current_thread->current_directory = dir_open(last_inode);
   dir_close(get_parent_dir(metadata));
+  free(metadata);
   return true;
 }
 
@@ -316,6 +336,92 @@ int inumber_helper (int fd) {
     return inode_get_inumber(file_get_inode(file->file));
   }
 }
+
+// Writes only the dirty blocks of the file open as FD to disk
+bool fsync_helper (int fd) {
+  open_file *file = get_file_by_fd(fd);
+  if (!file) {
+    return false;
+  }
+  if (file->dir) {
+    inode_sync(dir_get_inode(file->dir));
+  } else {
+    inode_sync(file_get_inode(file->file));
+  }
+  return true;
+}
+
+// Fills ENTRIES with up to CNT entries of the directory open as FD,
+// reading them from the directory in batches
+int getdents_helper (int fd, struct dirent *entries, int cnt) {
+  struct dir_record *records;
+  int filled = 0;
+
+  open_file *file = get_file_by_fd(fd);
+  if (!file || !file->dir || cnt < 0) {
+    return -1;
+  }
+  // the batch lives on the heap, the kernel stack is too small for it
+  records = malloc(16 * sizeof *records);
+  if (!records) {
+    return -1;
+  }
+  while (filled < cnt) {
+    size_t want = cnt - filled < 16 ? cnt - filled : 16;
+    size_t got = dir_read_batch(file->dir, records, want);
+    size_t i;
+    for (i = 0; i < got; i++) {
+      struct dirent *d = &entries[filled++];
+      d->inumber = records[i].inode_sector;
+      d->is_dir = records[i].is_dir;
+      strlcpy(d->name, records[i].name, sizeof d->name);
+    }
+    if (got < want) {
+      break;
+    }
+  }
+  free(records);
+  return filled;
+}
+
+// Copies the attributes of INODE into ST
+void fill_stat (struct inode *inode, struct stat *st) {
+  st->size = inode_length(inode);
+  st->is_dir = inode_is_dir(inode);
+  st->inumber = inode_get_inumber(inode);
+}
+
+// Fills ST for the file named FILE without opening it
+bool stat_helper (char *file, struct stat *st) {
+  struct thread *current_thread = thread_current();
+  struct resolve_metadata *metadata = resolve_path(current_thread->current_directory, file, false);
+  if (!metadata) {
+    return false;
+  }
+
+  struct dir *parent_dir = get_parent_dir(metadata);
+  struct inode *inode = get_last_inode(metadata);
+  fill_stat(inode, st);
+
+  inode_close(inode);
+  dir_close(parent_dir);
+  free(metadata);
+  return true;
+}
+
+// Fills ST for the file or directory open as FD
+bool fstat_helper (int fd, struct stat *st) {
+  open_file *file = get_file_by_fd(fd);
+  if (!file) {
+    return false;
+  }
+  if (file->dir) {
+    fill_stat(dir_get_inode(file->dir), st);
+  } else {
+    fill_stat(file_get_inode(file->file), st);
+  }
+  return true;
+}
   
 
 // Validate arguments for all syscalls
@@ -325,6 +431,25 @@ bool validate_arg (void *arg) {
   return arg != NULL && is_user_vaddr(ptr) && pagedir_get_page (current_thread->pagedir, ptr) != NULL;
 }
 
+// Validate every page of the SIZE bytes of user memory at BUFFER
+bool validate_buffer (void *buffer, size_t size) {
+  uintptr_t start = (uintptr_t) buffer;
+  uintptr_t page;
+  if (size == 0) {
+    return true;
+  }
+  if (!is_user_vaddr(buffer) || size > (uintptr_t) PHYS_BASE - start) {
+    return false;
+  }
+  for (page = (uintptr_t) pg_round_down(buffer); page < start + size;
+       page += PGSIZE) {
+    if (!validate_arg((void *) page)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 
 void
 syscall_init (void)
@@ -523,6 +648,47 @@ syscall_handler (struct intr_frame *f UNUSED)
     int fd = args[1];
     f->eax = inumber_helper(fd);
 
+  } else if (args[0] == SYS_FSYNC) {
+    int fd = args[1];
+    f->eax = fsync_helper(fd);
+
+  } else if (args[0] == SYS_GETDENTS) {
+    int fd = args[1];
+    struct dirent *entries = (struct dirent *) args[2];
+    int cnt = args[3];
+    // bound CNT first, so that the size of the buffer cannot overflow
+    if (cnt > 0 && ((size_t) cnt > SIZE_MAX / sizeof *entries
+                    || !validate_buffer(entries, cnt * sizeof *entries))) {
+      f->eax = -1;
+      printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
+      thread_exit ();
+    } else {
+      f->eax = getdents_helper(fd, entries, cnt);
+    }
+
+  } else if (args[0] == SYS_STAT) {
+    char *file = (char *) args[1];
+    struct stat *st = (struct stat *) args[2];
+    if (!validate_arg(file) || !validate_arg(st)
+        || !validate_arg((char *) (st + 1) - 1)) {
+      f->eax = -1;
+      printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
+      thread_exit ();
+    } else {
+      f->eax = stat_helper(file, st);
+    }
+
+  } else if (args[0] == SYS_FSTAT) {
+    int fd = args[1];
+    struct stat *st = (struct stat *) args[2];
+    if (!validate_arg(st) || !validate_arg((char *) (st + 1) - 1)) {
+      f->eax = -1;
+      printf ("%s: exit(%d)\n", &thread_current ()->name, -1);
+      thread_exit ();
+    } else {
+      f->eax = fstat_helper(fd, st);
+    }
+
   } else if (args[0] == SYS_GET_CACHE) {
     if (args[1] == 0) {
       reset_cache();
@@ -536,6 +702,10 @@ syscall_handler (struct intr_frame *f UNUSED)
       f->eax = block_read_write_cnt(fs_device,0);
     else if (args[1] == 4)
       f->eax = block_read_write_cnt(fs_device,1);
+    else if (args[1] == 5)
+      f->eax = cache_readahead;
+    else if (args[1] == 6)
+      f->eax = cache_readahead_hit;
     
   } else {
   	f->eax = -1;